@@ -0,0 +1,142 @@
+#include <algorithm>
+#include <mutex>
+#include <vector>
+
+#ifndef _WIN32
+#include <sys/resource.h>
+#endif
+
+#include "bench.h"
+
+using namespace std::chrono;
+
+/*---------------------------------------------------------------------------*/
+
+// Also the keys of the report, which must not change
+static const char *stageNames[STAGE_COUNT] = {
+    "context_init",
+    "file_read",
+    "json_parse",
+    "compile",
+    "link",
+    "uniforms",
+    "draw",
+    "readback",
+    "flip",
+    "encode",
+    "write",
+};
+
+static bool enabled = false;
+static std::mutex samplesMutex;
+static std::vector<int64_t> samples[STAGE_COUNT];   // In nanoseconds
+
+/*---------------------------------------------------------------------------*/
+
+void benchEnable() {
+    enabled = true;
+}
+
+bool benchEnabled() {
+    return enabled;
+}
+
+/*---------------------------------------------------------------------------*/
+
+void benchRecord(BenchStage stage, steady_clock::duration time) {
+    if (!enabled) {
+        return;
+    }
+    std::lock_guard<std::mutex> lock(samplesMutex);
+    samples[stage].push_back(duration_cast<nanoseconds>(time).count());
+}
+
+/*---------------------------------------------------------------------------*/
+
+BenchTimer::BenchTimer(BenchStage stage) : stage(stage), enabled(benchEnabled()) {
+    if (enabled) {
+        start = steady_clock::now();
+    }
+}
+
+BenchTimer::~BenchTimer() {
+    if (enabled) {
+        benchRecord(stage, steady_clock::now() - start);
+    }
+}
+
+/*---------------------------------------------------------------------------*/
+
+// Nearest rank percentile of sorted samples, in microseconds
+
+static double percentile(const std::vector<int64_t>& sorted, int percent) {
+    size_t rank = (sorted.size() * percent + 99) / 100;
+    return sorted[std::max(rank, (size_t) 1) - 1] / 1000.0;
+}
+
+// Buckets of up to 1us, 2us, 4us, ... the last one taking the rest
+#define BENCH_BUCKETS (32)
+
+static void addHistogram(nlohmann::json& stats, const std::vector<int64_t>& sorted) {
+    uint64_t counts[BENCH_BUCKETS] = { 0 };
+    for (size_t i = 0; i < sorted.size(); i++) {
+        int bucket = 0;
+        while (bucket < BENCH_BUCKETS - 1 && sorted[i] > (int64_t) 1000 << bucket) {
+            bucket++;
+        }
+        counts[bucket]++;
+    }
+    nlohmann::json& histogram = stats["histogram"];
+    histogram = nlohmann::json::array();
+    for (int bucket = 0; bucket < BENCH_BUCKETS; bucket++) {
+        if (counts[bucket] > 0) {
+            histogram.push_back(nlohmann::json::array({ (int64_t) 1 << bucket, counts[bucket] }));
+        }
+    }
+}
+
+/*---------------------------------------------------------------------------*/
+
+void benchReport(nlohmann::json& report) {
+    std::lock_guard<std::mutex> lock(samplesMutex);
+    nlohmann::json& stages = report["stages"];
+    for (int s = 0; s < STAGE_COUNT; s++) {
+        std::vector<int64_t> sorted(samples[s]);
+        std::sort(sorted.begin(), sorted.end());
+        nlohmann::json& stats = stages[stageNames[s]];
+        stats["count"] = sorted.size();
+        if (sorted.empty()) {
+            continue;
+        }
+        int64_t total = 0;
+        for (size_t i = 0; i < sorted.size(); i++) {
+            total += sorted[i];
+        }
+        stats["mean_us"] = total / 1000.0 / sorted.size();
+        stats["min_us"] = sorted.front() / 1000.0;
+        stats["median_us"] = percentile(sorted, 50);
+        stats["p90_us"] = percentile(sorted, 90);
+        stats["p99_us"] = percentile(sorted, 99);
+        stats["max_us"] = sorted.back() / 1000.0;
+        addHistogram(stats, sorted);
+    }
+}
+
+/*---------------------------------------------------------------------------*/
+
+int64_t benchPeakRSS() {
+#ifndef _WIN32
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) == 0) {
+        // In KiB on Linux, but in bytes on macOS
+#ifdef __APPLE__
+        return (int64_t) usage.ru_maxrss / 1024;
+#else
+        return (int64_t) usage.ru_maxrss;
+#endif
+    }
+#endif
+    return -1;
+}
+
+/*---------------------------------------------------------------------------*/
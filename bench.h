@@ -0,0 +1,58 @@
+#ifndef __GETIMAGE_BENCH__
+#define __GETIMAGE_BENCH__
+
+#include <chrono>
+#include <stdint.h>
+
+#include "json.hpp"
+
+/*---------------------------------------------------------------------------*/
+// Latencies of the stages of each run, for --bench. Until benchEnable(),
+// timers cost the test of a flag.
+/*---------------------------------------------------------------------------*/
+
+typedef enum {
+    STAGE_CONTEXT_INIT,
+    STAGE_FILE_READ,
+    STAGE_JSON_PARSE,
+    STAGE_COMPILE,    // Both shaders
+    STAGE_LINK,
+    STAGE_UNIFORMS,
+    STAGE_DRAW,       // All the frames of a run
+    STAGE_READBACK,
+    STAGE_FLIP,
+    STAGE_ENCODE,
+    STAGE_WRITE,
+    STAGE_COUNT
+} BenchStage;
+
+void benchEnable();
+bool benchEnabled();
+
+// Safe to call from several threads
+void benchRecord(BenchStage stage, std::chrono::steady_clock::duration time);
+
+// Records the time spent in its scope
+class BenchTimer {
+public:
+    explicit BenchTimer(BenchStage stage);
+    ~BenchTimer();
+
+private:
+    BenchStage stage;
+    bool enabled;
+    std::chrono::steady_clock::time_point start;
+};
+
+// Add the statistics of each stage to report, under "stages": count, mean,
+// min, percentiles and max in microseconds, and a histogram of
+// [upper bound, count] pairs over fixed power of two buckets, which can be
+// compared between runs.
+void benchReport(nlohmann::json& report);
+
+// Peak resident set size of the process in KiB, -1 if unknown
+int64_t benchPeakRSS();
+
+/*---------------------------------------------------------------------------*/
+
+#endif
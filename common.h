@@ -3,52 +3,187 @@
 
 #include <stdlib.h> // exit()
 #include <stdio.h>  // printf()
+#include <stdint.h>
 #include <string>
 /*---------------------------------------------------------------------------*/
 
+// These codes mimic the ones used in 'get-image-glfw'
+#define COMPILE_ERROR_EXIT_CODE (101)
+#define LINK_ERROR_EXIT_CODE (102)
+// The image differs from the --reference one
+#define MISMATCH_EXIT_CODE (103)
+
+// Outcome of a rendering step: EXIT_SUCCESS, EXIT_FAILURE or one of the
+// codes above. Steps return it to the job runner instead of exiting, so a
+// batch run can go on with the next shader; in single shader mode, it
+// ends up as the program return value.
+typedef int JobStatus;
+
+// 4 channels: RGBA
+#define CHANNELS (4)
+
+// Values of Params.device besides device indices
+#define DEVICE_DEFAULT (-1) // Surfaceless platform if any, else device 0
+#define DEVICE_ALL     (-2) // One device after the other for the workers
+
+/*---------------------------------------------------------------------------*/
+
 typedef enum {
     API_OPENGL,
     API_OPENGL_ES,
 } API_TYPE;
 
+// Profile of the #version directive of the fragment shader
+typedef enum {
+    PROFILE_NONE,
+    PROFILE_ES,
+    PROFILE_CORE,
+    PROFILE_COMPATIBILITY,
+} SHADER_PROFILE;
+
+typedef enum {
+    PNG_LEVEL_DEFAULT,  // lodepng defaults: smallest files
+    PNG_LEVEL_FAST,     // short lz77 search
+    PNG_LEVEL_STORE,    // no filtering, no compression
+} PNG_LEVEL;
+
+typedef enum {
+    OUTPUT_PNG,
+    OUTPUT_RAW,   // RawHeader then RGBA pixels, see output.h
+    OUTPUT_PPM,   // RGB, alpha is dropped
+    OUTPUT_PAM,   // RGBA
+    OUTPUT_MMAP,  // Raw images written into an existing file
+} OUTPUT_FORMAT;
+
+typedef enum {
+    FBO_NONE,     // Render to the window or pbuffer
+    FBO_RGBA8,
+} FBO_FORMAT;
+
+// When OpenGL errors are looked for, see GL_CHECKERR and GL_CHECKSTAGE
+typedef enum {
+    GL_ERRORS_STRICT,    // glGetError() after each call
+    GL_ERRORS_DEFERRED,  // glGetError() once per stage
+    GL_ERRORS_DEBUG,     // GL_KHR_debug callback, looked at once per stage
+} GL_ERRORS;
+
 typedef struct {
     int width;
     int height;
     int shaderVersion;
+    SHADER_PROFILE shaderProfile;
     int APIVersion;
     API_TYPE API;
-    int delay;
+    int delay;        // 0 to only draw the frames that are needed
+    int framesDrawn;
     uint32_t program; // Is GLuint, but missing OpenGL headers here
+    uint32_t vertexShader;  // Shared by the jobs of the context, not owned
+    uint32_t fragmentShader;
+    uint32_t uniformBuffer;
     std::string fragFilename;
     std::string vertFilename;
+    std::string jsonFilename;
     std::string output;
+    std::string batchFilename;
+    std::string benchDir;
+    int benchRepeats;
+    int workers;
+    int parallelCompile;
+    std::string programCache;
+    std::string contextCache;
+    int device;       // EGL device of the headless version, see DEVICE_*
+    std::string programCacheKey;
+    bool programCached;
+    std::string memoDir;
+    std::string memoKey;  // "" if the job result is not to be memoized
+    bool memoHit;
+    int asyncReadback;
+    int pngThreads;
+    PNG_LEVEL pngLevel;
+    OUTPUT_FORMAT outputFormat;
+    bool flip;
+    uint64_t outputOffset;
+    bool hashImage;
+    std::string reference;
+    int tolerance;
+    FBO_FORMAT fboFormat;
+    GL_ERRORS glErrors;
+    int tileSize;
+    bool atlas;           // With --fbo, draw the variants of a job into one framebuffer
     bool exitCompile;
     bool exitLinking;
     bool persist;
     bool animate;
     bool profile;
+    int gpuTimeRepeats;   // Draws timed with GPU queries, 0 for none
+    int64_t compileTime;  // CPU time of both compilations, in microseconds, -1 if none
+    int64_t linkTime;
+    int64_t renderTime;   // CPU time of the other steps, also -1 if not done
+    int64_t readbackTime;
+    int64_t encodeTime;
+    std::string infoLog;  // Compile and link logs, warnings included with --metrics-fd
+    std::string glVendor;
+    std::string glRenderer;
+    std::string glVersion;
+    int metricsFd;        // File descriptor of the job records, -1 for none
     std::string timeVarName;
+    int32_t timeLocation;   // Of the time uniform, -1 if not animated
+    int sequenceFrames;     // Frames of a --frames sequence, 0 for none
+    double timeStart;       // Time uniform of sequence frame i: timeStart + i * timeStep
+    double timeStep;
+    int captureEvery;
+    double frameTime;       // Time uniform of the frame being drawn
+    std::string variantsFilename;   // JSONL file of uniform sets, one image each
+    int variantsDrawn;
     std::string binOut;
+    std::string traceFile;
 } Params;
 
 /*---------------------------------------------------------------------------*/
 
 #define errcode_crash(errcode, fmt, ...) do {                           \
-        printf("%s:%d (%s) ERROR: ", __FILE__, __LINE__, __func__);     \
-        printf(fmt, ##__VA_ARGS__);                                     \
-        printf("\n");                                                   \
+        printf("%s:%d (%s) ERROR: " fmt "\n",                           \
+               __FILE__, __LINE__, __func__, ##__VA_ARGS__);            \
         exit (errcode);                                                 \
     } while (0)
 
 /*---------------------------------------------------------------------------*/
 
+// Same as errcode_crash(), but returns errcode from the calling function
+// rather than exiting, for errors a batch run can survive. The message is
+// printed with a single call, so lines from batch workers do not mix.
+
+#define errcode_return(errcode, fmt, ...) do {                          \
+        printf("%s:%d (%s) ERROR: " fmt "\n",                           \
+               __FILE__, __LINE__, __func__, ##__VA_ARGS__);            \
+        return (errcode);                                               \
+    } while (0)
+
+#define error_return(fmt, ...) do {                                     \
+        printf("%s:%d (%s) ERROR: " fmt "\n",                           \
+               __FILE__, __LINE__, __func__, ##__VA_ARGS__);            \
+        return (EXIT_FAILURE);                                          \
+    } while (0)
+
+/*---------------------------------------------------------------------------*/
+
+// Return early from the calling function if a step did not succeed.
+
+#define CHECK_STATUS(expr) do {                                         \
+        JobStatus __status = (expr);                                    \
+        if (__status != EXIT_SUCCESS) {                                 \
+            return __status;                                            \
+        }                                                               \
+    } while (0)
+
+/*---------------------------------------------------------------------------*/
+
 // Hugues: we should just call errcode_crash(EXIT_FAILURE, fmt,
 // __VA_ARGS__), but compiler complains.
 
 #define crash(fmt, ...) do {                           \
-        printf("%s:%d (%s) ERROR: ", __FILE__, __LINE__, __func__);     \
-        printf(fmt, ##__VA_ARGS__);                                     \
-        printf("\n");                                                   \
+        printf("%s:%d (%s) ERROR: " fmt "\n",                           \
+               __FILE__, __LINE__, __func__, ##__VA_ARGS__);            \
         exit (EXIT_FAILURE);                                            \
     } while (0)
 
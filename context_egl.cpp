@@ -1,13 +1,51 @@
+#include <algorithm>
+
 #include "context_egl.h"
 
 /*---------------------------------------------------------------------------*/
 
+static const EGLint context_attrib_list[] =
+    {
+        EGL_CONTEXT_CLIENT_VERSION, 3,
+        EGL_NONE
+    };
+
+/*---------------------------------------------------------------------------*/
+
+static void createSurface(Context& ctx, int width, int height) {
+    const EGLint pbuffer_attrib_list[] =
+        {
+            EGL_WIDTH, width,
+            EGL_HEIGHT, height,
+            EGL_TEXTURE_FORMAT,  EGL_NO_TEXTURE,
+            EGL_TEXTURE_TARGET, EGL_NO_TEXTURE,
+            EGL_LARGEST_PBUFFER, EGL_TRUE,
+            EGL_NONE
+        };
+
+    ctx.surface = eglCreatePbufferSurface(ctx.display, ctx.config, pbuffer_attrib_list);
+    if(ctx.surface == EGL_NO_SURFACE) {
+        crash("eglCreatePbufferSurface failed: %x", eglGetError());
+    }
+
+    // EGL_LARGEST_PBUFFER may give us a smaller surface
+    EGLint w = 0;
+    EGLint h = 0;
+    eglQuerySurface(ctx.display, ctx.surface, EGL_WIDTH, &w);
+    eglQuerySurface(ctx.display, ctx.surface, EGL_HEIGHT, &h);
+    ctx.width = w;
+    ctx.height = h;
+
+    eglMakeCurrent(ctx.display, ctx.surface, ctx.surface, ctx.context);
+}
+
+/*---------------------------------------------------------------------------*/
+
 void contextInitAndGetAPI(Params& params, Context& ctx) {
 
     EGLDisplay& display = ctx.display;
     EGLConfig& config = ctx.config;
     EGLContext& context = ctx.context;
-    EGLSurface& surface = ctx.surface;
 
     const EGLint config_attribute_list[] =
         {
@@ -23,22 +61,6 @@ void contextInitAndGetAPI(Params& params, Context& ctx) {
             EGL_NONE
         };
 
-    const EGLint context_attrib_list[] =
-        {
-            EGL_CONTEXT_CLIENT_VERSION, 3,
-            EGL_NONE
-        };
-
-    const EGLint pbuffer_attrib_list[] =
-        {
-            EGL_WIDTH, params.width,
-            EGL_HEIGHT, params.height,
-            EGL_TEXTURE_FORMAT,  EGL_NO_TEXTURE,
-            EGL_TEXTURE_TARGET, EGL_NO_TEXTURE,
-            EGL_LARGEST_PBUFFER, EGL_TRUE,
-            EGL_NONE
-        };
-
     display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
 
     EGLint major;
@@ -48,9 +70,6 @@ void contextInitAndGetAPI(Params& params, Context& ctx) {
         crash("%s", "eglInitialize failed.");
     }
 
-    params.APIVersion = ((int)major * 100) + ((int) minor * 10);
-    params.API = API_OPENGL_ES;
-
     EGLint num_config;
     if(eglChooseConfig(display, config_attribute_list, &config, 1, &num_config) == EGL_FALSE) {
         crash("%s", "eglChooseConfig failed.");
@@ -65,12 +84,15 @@ void contextInitAndGetAPI(Params& params, Context& ctx) {
         crash("eglCreateContext failed: %x", eglGetError());
     }
 
-    surface = eglCreatePbufferSurface(display, config, pbuffer_attrib_list);
-    if(surface == EGL_NO_SURFACE) {
-        crash("eglCreatePbufferSurface failed: %x", eglGetError());
-    }
+    createSurface(ctx, params.width, params.height);
 
-    eglMakeCurrent(display, surface, surface, context);
+    // The version from eglInitialize() is the EGL one, not the GLES one
+    GLint glMajor = 0;
+    GLint glMinor = 0;
+    glGetIntegerv(GL_MAJOR_VERSION, &glMajor);
+    glGetIntegerv(GL_MINOR_VERSION, &glMinor);
+    params.APIVersion = ((int)glMajor * 100) + ((int) glMinor * 10);
+    params.API = API_OPENGL_ES;
 }
 
 /*---------------------------------------------------------------------------*/
@@ -85,6 +107,19 @@ void contextSwap(Context& ctx) {
     eglSwapBuffers(ctx.display, ctx.surface);
 }
 
+/*---------------------------------------------------------------------------*/
+
+// The pbuffer is only ever grown: rendering uses the bottom-left corner.
+
+void contextResize(Context& ctx, int width, int height) {
+    if (width <= ctx.width && height <= ctx.height) {
+        return;
+    }
+    eglMakeCurrent(ctx.display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+    eglDestroySurface(ctx.display, ctx.surface);
+    createSurface(ctx, std::max(width, ctx.width), std::max(height, ctx.height));
+}
+
 
 /*---------------------------------------------------------------------------*/
 
@@ -99,3 +134,27 @@ void contextTerminate(Context& ctx) {
 }
 
 /*---------------------------------------------------------------------------*/
+
+// Worker contexts share the display and config of the main context, but
+// have their own context and pbuffer, current on the calling thread.
+
+void contextInitWorker(const Context& main, Context& ctx, const Params& params) {
+    ctx.display = main.display;
+    ctx.config = main.config;
+    ctx.context = eglCreateContext(ctx.display, ctx.config, EGL_NO_CONTEXT, context_attrib_list);
+    if(ctx.context == EGL_NO_CONTEXT) {
+        crash("eglCreateContext failed: %x", eglGetError());
+    }
+    createSurface(ctx, params.width, params.height);
+}
+
+/*---------------------------------------------------------------------------*/
+
+void contextTerminateWorker(Context& ctx) {
+    eglMakeCurrent(ctx.display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+    eglDestroySurface(ctx.display, ctx.surface);
+    eglDestroyContext(ctx.display, ctx.context);
+    eglReleaseThread();
+}
+
+/*---------------------------------------------------------------------------*/
@@ -6,12 +6,16 @@
 #include <GLES/gl.h>
 #include <GLES3/gl3.h>
 #include "common.h"
+#include "framebuffer.h"
 
 typedef struct {
     EGLDisplay display;
     EGLConfig config;
     EGLContext context;
     EGLSurface surface;
+    int width;  // Size of the pbuffer surface
+    int height;
+    Framebuffer framebuffer;  // With --fbo
 } Context;
 
 #endif
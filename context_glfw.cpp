@@ -1,64 +1,269 @@
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <stdio.h>
+#include <stdlib.h>
+
 #include "context_glfw.h"
+#include "filemap.h"
 
 static void errorCallback(int error, const char* description) {
-    if (error == GLFW_VERSION_UNAVAILABLE) {
-        // Silent this error, which can happen as we loop over versions
+    if (error == GLFW_VERSION_UNAVAILABLE || error == GLFW_API_UNAVAILABLE) {
+        // Silent these errors, which can happen as we loop over versions
         // to find the highest one available.
         return;
     }
     crash("GLFW Error %d: %s", error, description);
 }
 
+/*---------------------------------------------------------------------------*/
+// Context selection
 /*---------------------------------------------------------------------------*/
 
-void contextInitAndGetAPI(Params& params, Context& ctx) {
+typedef enum {
+    KIND_ANY,       // OpenGL, any profile
+    KIND_CORE,
+    KIND_COMPAT,
+    KIND_ES,
+    KIND_COUNT
+} ContextKind;
 
-    glfwSetErrorCallback(errorCallback);
+static const char *kindNames[KIND_COUNT] = { "gl", "core", "compat", "es" };
 
-    if (!glfwInit()) {
-        crash("%s", "glfwInit()");
-    }
+// Highest version of each kind of context, 0 if there is none, -1 if it
+// has not been probed
+typedef struct {
+    int versions[KIND_COUNT];
+    bool dirty;
+} ContextCaps;
+
+static const int glVersions[] = {
+    460, 450, 440, 430, 420, 410, 400,
+    330, 320, 310, 300,
+    210, 200,
+};
 
-    // TODO: Must request GLFW_OPENGL_ANY_PROFILE for profiles below
-    // 3.2, but we could request core / compat depending on the version.
-    glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_ANY_PROFILE);
-    //glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_COMPAT_PROFILE);
+// Profiles only exist from OpenGL 3.2
+static const int profileVersions[] = {
+    460, 450, 440, 430, 420, 410, 400,
+    330, 320,
+};
 
-    // TODO: here, try OpenGL ES API depending on the shader version?
-    glfwWindowHint(GLFW_CLIENT_API, GLFW_OPENGL_API);
+static const int esVersions[] = {
+    320, 310, 300, 200,
+};
 
-    // Create window using the highest possible version
-    int versions[] = {
-        460, 450, 440, 430, 420, 410, 400,
-        330, 320, 310, 300,
-        210, 200,
-    };
+/*---------------------------------------------------------------------------*/
 
-    GLFWwindow* window = NULL;
+static GLFWwindow *createWindow(const Params& params, ContextKind kind, int version) {
+    glfwDefaultWindowHints();
+    glfwWindowHint(GLFW_CLIENT_API, kind == KIND_ES ? GLFW_OPENGL_ES_API : GLFW_OPENGL_API);
+    if (kind == KIND_CORE) {
+        glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+    } else if (kind == KIND_COMPAT) {
+        glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_COMPAT_PROFILE);
+    } else {
+        glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_ANY_PROFILE);
+    }
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, version / 100);
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, (version % 100) / 10);
+    return glfwCreateWindow(params.width, params.height, "get_image_glfw", NULL, NULL);
+}
 
-    for (unsigned i = 0; i < (sizeof(versions) / sizeof(versions[0])); i++) {
-        int majorHint = versions[i] / 100;
-        int minorHint = (versions[i] % 100) / 10;
-        glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, majorHint);
-        glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, minorHint);
-        window = glfwCreateWindow(params.width, params.height, "get_image_glfw", NULL, NULL);
+/*---------------------------------------------------------------------------*/
+
+// Create a window with the highest version of this kind, and record it
+static GLFWwindow *probeWindow(const Params& params, ContextKind kind, ContextCaps& caps) {
+    const int *versions = glVersions;
+    size_t count = sizeof(glVersions) / sizeof(glVersions[0]);
+    if (kind == KIND_CORE || kind == KIND_COMPAT) {
+        versions = profileVersions;
+        count = sizeof(profileVersions) / sizeof(profileVersions[0]);
+    } else if (kind == KIND_ES) {
+        versions = esVersions;
+        count = sizeof(esVersions) / sizeof(esVersions[0]);
+    }
+
+    caps.versions[kind] = 0;
+    caps.dirty = true;
+    for (size_t i = 0; i < count; i++) {
+        GLFWwindow *window = createWindow(params, kind, versions[i]);
         if (window != NULL) {
-            break;
+            caps.versions[kind] = versions[i];
+            return window;
+        }
+    }
+    return NULL;
+}
+
+/*---------------------------------------------------------------------------*/
+
+// The context version needed by a shader version
+static int neededVersion(const Params& params) {
+    int v = params.shaderVersion;
+    if (params.shaderProfile == PROFILE_ES) {
+        return v == 100 ? 200 : v;
+    }
+    switch (v) {
+    case 110: return 200;
+    case 120: return 210;
+    case 130: return 300;
+    case 140: return 310;
+    case 150: return 320;
+    }
+    return v;
+}
+
+/*---------------------------------------------------------------------------*/
+// Capability cache: one "<device> <kind> <version>" line per probed kind
+// of context. Devices are told apart by their display.
+
+static std::string deviceName() {
+    const char *names[] = { "DISPLAY", "WAYLAND_DISPLAY" };
+    for (unsigned i = 0; i < (sizeof(names) / sizeof(names[0])); i++) {
+        const char *name = getenv(names[i]);
+        if (name != NULL && name[0] != '\0') {
+            return name;
+        }
+    }
+    return "default";
+}
+
+static void loadCaps(const std::string& filename, const std::string& device, ContextCaps& caps) {
+    for (int k = 0; k < KIND_COUNT; k++) {
+        caps.versions[k] = -1;
+    }
+    caps.dirty = false;
+    if (filename == "") {
+        return;
+    }
+    std::ifstream ifs(filename.c_str());
+    std::string d;
+    std::string kind;
+    int version;
+    while (ifs >> d >> kind >> version) {
+        for (int k = 0; d == device && k < KIND_COUNT; k++) {
+            if (kind == kindNames[k]) {
+                caps.versions[k] = version;
+            }
+        }
+    }
+}
+
+// Rewrite the file with the lines of the other devices, then ours
+static void saveCaps(const std::string& filename, const std::string& device, const ContextCaps& caps) {
+    std::vector<std::string> lines;
+    std::ifstream ifs(filename.c_str());
+    std::string line;
+    while (std::getline(ifs, line)) {
+        std::istringstream ss(line);
+        std::string d;
+        if (ss >> d && d != device) {
+            lines.push_back(line);
+        }
+    }
+    ifs.close();
+
+    std::ostringstream out;
+    for (size_t i = 0; i < lines.size(); i++) {
+        out << lines[i] << std::endl;
+    }
+    for (int k = 0; k < KIND_COUNT; k++) {
+        if (caps.versions[k] >= 0) {
+            out << device << " " << kindNames[k] << " " << caps.versions[k] << std::endl;
         }
     }
+    if (!writeFileAtomic(filename, out.str())) {
+        printf("Warning: cannot write context cache %s\n", filename.c_str());
+    }
+}
+
+/*---------------------------------------------------------------------------*/
+
+// Create the context matching the shader: OpenGL ES for ES shaders, and
+// the requested profile for the others, with OpenGL of any profile as a
+// fallback. The highest version of each kind is probed once, then read
+// from params.contextCache if given.
+
+static GLFWwindow *selectWindow(const Params& params, ContextKind& kind) {
+    // Without a profile, the fallback is the only kind to try
+    ContextKind kinds[2] = { KIND_ANY, KIND_ANY };
+    int numKinds = 2;
+    if (params.shaderProfile == PROFILE_ES) {
+        kinds[0] = KIND_ES;
+    } else if (params.shaderProfile == PROFILE_CORE) {
+        kinds[0] = KIND_CORE;
+    } else if (params.shaderProfile == PROFILE_COMPATIBILITY) {
+        kinds[0] = KIND_COMPAT;
+    } else {
+        numKinds = 1;
+    }
+    int needed = neededVersion(params);
+
+    std::string device = deviceName();
+    ContextCaps caps;
+    loadCaps(params.contextCache, device, caps);
+
+    GLFWwindow *window = NULL;
+    for (int i = 0; i < numKinds && window == NULL; i++) {
+        kind = kinds[i];
+        bool last = (kind == KIND_ANY);
+        int version = caps.versions[kind];
+        if (version > 0 && (version >= needed || last)) {
+            window = createWindow(params, kind, version);
+            if (window == NULL) {
+                // Stale cache entry, e.g. after a driver update
+                version = -1;
+            }
+        }
+        if (version < 0) {
+            window = probeWindow(params, kind, caps);
+            if (window != NULL && caps.versions[kind] < needed && !last) {
+                glfwDestroyWindow(window);
+                window = NULL;
+            }
+        }
+    }
+
+    if (caps.dirty && params.contextCache != "") {
+        saveCaps(params.contextCache, device, caps);
+    }
+    return window;
+}
+
+/*---------------------------------------------------------------------------*/
+
+void contextInitAndGetAPI(Params& params, Context& ctx) {
+
+    glfwSetErrorCallback(errorCallback);
+
+    if (!glfwInit()) {
+        crash("%s", "glfwInit()");
+    }
+
+    ContextKind kind;
+    GLFWwindow* window = selectWindow(params, kind);
     if (window == NULL) {
         crash("%s", "glfwCreateWindow()");
     }
 
-    params.API = API_OPENGL;
+    params.API = (kind == KIND_ES) ? API_OPENGL_ES : API_OPENGL;
     int major = glfwGetWindowAttrib(window, GLFW_CONTEXT_VERSION_MAJOR);
     int minor = glfwGetWindowAttrib(window, GLFW_CONTEXT_VERSION_MINOR);
     params.APIVersion = ((int)major * 100) + ((int) minor * 10);
 
     glfwMakeContextCurrent(window);
-    gladLoadGLLoader((GLADloadproc) glfwGetProcAddress);
-    glfwSwapInterval(1);
+    if (kind == KIND_ES) {
+        gladLoadGLES2Loader((GLADloadproc) glfwGetProcAddress);
+    } else {
+        gladLoadGLLoader((GLADloadproc) glfwGetProcAddress);
+    }
+    // Only wait for the display when the window is there to be looked at
+    glfwSwapInterval(params.persist ? 1 : 0);
     ctx.window = window;
+    ctx.width = params.width;
+    ctx.height = params.height;
 }
 
 /*---------------------------------------------------------------------------*/
@@ -76,6 +281,17 @@ void contextSwap(Context& ctx) {
 
 /*---------------------------------------------------------------------------*/
 
+void contextResize(Context& ctx, int width, int height) {
+    if (width == ctx.width && height == ctx.height) {
+        return;
+    }
+    glfwSetWindowSize(ctx.window, width, height);
+    ctx.width = width;
+    ctx.height = height;
+}
+
+/*---------------------------------------------------------------------------*/
+
 static void keyCallback(GLFWwindow* window, int key, int scancode, int action, int mods) {
     exit(EXIT_SUCCESS);
 }
@@ -94,3 +310,17 @@ void contextTerminate(Context& ctx) {
 }
 
 /*---------------------------------------------------------------------------*/
+
+// GLFW windows must be created and polled from the main thread, so there
+// is no worker context support.
+
+void contextInitWorker(const Context& main, Context& ctx, const Params& params) {
+    crash("%s", "worker threads are not supported with GLFW, use the EGL version");
+}
+
+/*---------------------------------------------------------------------------*/
+
+void contextTerminateWorker(Context& ctx) {
+}
+
+/*---------------------------------------------------------------------------*/
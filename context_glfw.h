@@ -2,6 +2,7 @@
 #define __GETIMAGE_GLFW__
 
 #include "common.h" // Params
+#include "framebuffer.h"
 
 // glad is a OpenGL loader recommended by GLFW, see GLFW documentation
 #include "glad/glad.h"
@@ -9,6 +10,9 @@
 
 typedef struct {
     GLFWwindow* window;
+    int width;
+    int height;
+    Framebuffer framebuffer;  // With --fbo
 } Context;
 
 #endif
@@ -0,0 +1,222 @@
+#include <mutex>
+#include <string.h>
+#include <vector>
+
+#include "context_headless.h"
+
+#ifndef EGL_PLATFORM_SURFACELESS_MESA
+#define EGL_PLATFORM_SURFACELESS_MESA 0x31DD
+#endif
+
+/*---------------------------------------------------------------------------*/
+
+static const EGLint context_attrib_list[] =
+    {
+        EGL_CONTEXT_CLIENT_VERSION, 3,
+        EGL_NONE
+    };
+
+// Displays of the devices used by the workers, with --device all
+static std::mutex displaysMutex;
+static std::vector<EGLDisplay> displays;
+static int nextWorkerDevice = 0;
+
+/*---------------------------------------------------------------------------*/
+
+static bool hasExtension(const char *extensions, const char *name) {
+    size_t n = strlen(name);
+    const char *p = extensions;
+    while (p != NULL && (p = strstr(p, name)) != NULL) {
+        if ((p == extensions || p[-1] == ' ') && (p[n] == ' ' || p[n] == '\0')) {
+            return true;
+        }
+        p += n;
+    }
+    return false;
+}
+
+/*---------------------------------------------------------------------------*/
+
+static int deviceCount() {
+    const char *extensions = eglQueryString(EGL_NO_DISPLAY, EGL_EXTENSIONS);
+    if (!hasExtension(extensions, "EGL_EXT_device_enumeration") && !hasExtension(extensions, "EGL_EXT_device_base")) {
+        return 0;
+    }
+    PFNEGLQUERYDEVICESEXTPROC queryDevices = (PFNEGLQUERYDEVICESEXTPROC) eglGetProcAddress("eglQueryDevicesEXT");
+    EGLint count = 0;
+    if (queryDevices == NULL || !queryDevices(0, NULL, &count)) {
+        return 0;
+    }
+    return count;
+}
+
+/*---------------------------------------------------------------------------*/
+
+// Device -1 is the surfaceless platform if there is one, else device 0
+
+static EGLDisplay getDisplay(int device) {
+    const char *extensions = eglQueryString(EGL_NO_DISPLAY, EGL_EXTENSIONS);
+    if (extensions == NULL || !hasExtension(extensions, "EGL_EXT_platform_base")) {
+        crash("%s", "EGL_EXT_platform_base is not supported");
+    }
+    PFNEGLGETPLATFORMDISPLAYEXTPROC getPlatformDisplay =
+        (PFNEGLGETPLATFORMDISPLAYEXTPROC) eglGetProcAddress("eglGetPlatformDisplayEXT");
+    if (getPlatformDisplay == NULL) {
+        crash("%s", "eglGetPlatformDisplayEXT not found");
+    }
+
+    if (device < 0 && hasExtension(extensions, "EGL_MESA_platform_surfaceless")) {
+        return getPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, NULL);
+    }
+    if (device < 0) {
+        device = 0;
+    }
+    if (!hasExtension(extensions, "EGL_EXT_platform_device")) {
+        crash("%s", "EGL_EXT_platform_device is not supported");
+    }
+    int count = deviceCount();
+    if (device >= count) {
+        crash("No EGL device %d, there are %d", device, count);
+    }
+    std::vector<EGLDeviceEXT> devices(count);
+    EGLint n = 0;
+    PFNEGLQUERYDEVICESEXTPROC queryDevices = (PFNEGLQUERYDEVICESEXTPROC) eglGetProcAddress("eglQueryDevicesEXT");
+    queryDevices(count, devices.data(), &n);
+    return getPlatformDisplay(EGL_PLATFORM_DEVICE_EXT, devices[device], NULL);
+}
+
+/*---------------------------------------------------------------------------*/
+
+static void initDisplay(Context& ctx, int device) {
+    ctx.display = getDisplay(device);
+    if (ctx.display == EGL_NO_DISPLAY) {
+        crash("eglGetPlatformDisplayEXT failed: %x", eglGetError());
+    }
+    EGLint major;
+    EGLint minor;
+    if (eglInitialize(ctx.display, &major, &minor) == EGL_FALSE) {
+        crash("eglInitialize failed: %x", eglGetError());
+    }
+    if (!hasExtension(eglQueryString(ctx.display, EGL_EXTENSIONS), "EGL_KHR_surfaceless_context")) {
+        crash("%s", "EGL_KHR_surfaceless_context is not supported");
+    }
+
+    // No surface, so any surface type will do
+    const EGLint config_attribute_list[] =
+        {
+            EGL_SURFACE_TYPE, 0,
+            EGL_RENDERABLE_TYPE, EGL_OPENGL_ES3_BIT,
+            EGL_NONE
+        };
+    EGLint num_config;
+    if (eglChooseConfig(ctx.display, config_attribute_list, &ctx.config, 1, &num_config) == EGL_FALSE || num_config != 1) {
+        crash("%s", "eglChooseConfig did not return 1 config.");
+    }
+}
+
+/*---------------------------------------------------------------------------*/
+
+static void createContext(Context& ctx) {
+    ctx.context = eglCreateContext(ctx.display, ctx.config, EGL_NO_CONTEXT, context_attrib_list);
+    if (ctx.context == EGL_NO_CONTEXT) {
+        crash("eglCreateContext failed: %x", eglGetError());
+    }
+    if (!eglMakeCurrent(ctx.display, EGL_NO_SURFACE, EGL_NO_SURFACE, ctx.context)) {
+        crash("eglMakeCurrent failed: %x", eglGetError());
+    }
+}
+
+/*---------------------------------------------------------------------------*/
+
+void contextInitAndGetAPI(Params& params, Context& ctx) {
+    initDisplay(ctx, params.device == DEVICE_ALL ? 0 : params.device);
+    createContext(ctx);
+    ctx.width = params.width;
+    ctx.height = params.height;
+
+    // Without a surface, only the framebuffer object can be rendered to
+    if (params.fboFormat == FBO_NONE) {
+        params.fboFormat = FBO_RGBA8;
+    }
+
+    GLint glMajor = 0;
+    GLint glMinor = 0;
+    glGetIntegerv(GL_MAJOR_VERSION, &glMajor);
+    glGetIntegerv(GL_MINOR_VERSION, &glMinor);
+    params.APIVersion = ((int)glMajor * 100) + ((int) glMinor * 10);
+    params.API = API_OPENGL_ES;
+}
+
+/*---------------------------------------------------------------------------*/
+
+bool contextKeepLooping(Context &ctx) {
+    return true;
+}
+
+/*---------------------------------------------------------------------------*/
+
+// Nothing to present: frames only need to be submitted
+
+void contextSwap(Context& ctx) {
+    glFlush();
+}
+
+/*---------------------------------------------------------------------------*/
+
+void contextResize(Context& ctx, int width, int height) {
+    ctx.width = width;
+    ctx.height = height;
+}
+
+/*---------------------------------------------------------------------------*/
+
+void contextSetKeyCallback(Context& ctx) {
+    printf("Warning: no key callback support with headless EGL!\n");
+}
+
+/*---------------------------------------------------------------------------*/
+
+void contextTerminate(Context& ctx) {
+    eglMakeCurrent(ctx.display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+    eglDestroyContext(ctx.display, ctx.context);
+    std::lock_guard<std::mutex> lock(displaysMutex);
+    for (size_t i = 0; i < displays.size(); i++) {
+        if (displays[i] != ctx.display) {
+            eglTerminate(displays[i]);
+        }
+    }
+    displays.clear();
+    eglTerminate(ctx.display);
+}
+
+/*---------------------------------------------------------------------------*/
+
+// Worker contexts use the display of the main context, or with --device
+// all, the devices in turn, so that each device gets its share of the
+// workers.
+
+void contextInitWorker(const Context& main, Context& ctx, const Params& params) {
+    if (params.device != DEVICE_ALL) {
+        ctx.display = main.display;
+        ctx.config = main.config;
+    } else {
+        std::lock_guard<std::mutex> lock(displaysMutex);
+        int count = deviceCount();
+        int device = count > 0 ? nextWorkerDevice++ % count : 0;
+        initDisplay(ctx, device);
+        displays.push_back(ctx.display);
+    }
+    createContext(ctx);
+    ctx.width = params.width;
+    ctx.height = params.height;
+}
+
+/*---------------------------------------------------------------------------*/
+
+void contextTerminateWorker(Context& ctx) {
+    eglMakeCurrent(ctx.display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+    eglDestroyContext(ctx.display, ctx.context);
+    eglReleaseThread();
+}
+
+/*---------------------------------------------------------------------------*/
@@ -0,0 +1,25 @@
+#ifndef __GETIMAGE_HEADLESS__
+#define __GETIMAGE_HEADLESS__
+
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#define GL_GLEXT_PROTOTYPES
+#include <GLES/gl.h>
+#include <GLES3/gl3.h>
+#include "common.h"
+#include "framebuffer.h"
+
+// EGL without any window system: a surfaceless context on the Mesa
+// surfaceless platform, or on one of the devices of EGL_EXT_platform_device.
+// There is no surface, so rendering always goes to the framebuffer object.
+
+typedef struct {
+    EGLDisplay display;
+    EGLConfig config;
+    EGLContext context;
+    int width;  // Unused, there is no surface
+    int height;
+    Framebuffer framebuffer;
+} Context;
+
+#endif
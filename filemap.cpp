@@ -0,0 +1,126 @@
+#include <fstream>
+#include <iterator>
+#include <sstream>
+#include <thread>
+#include <utility>
+#include <stdio.h>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#else
+#include <windows.h>
+#endif
+
+#include "filemap.h"
+#include "trace.h"
+
+/*---------------------------------------------------------------------------*/
+
+void FileContents::release() {
+#ifndef _WIN32
+    if (mapping != NULL) {
+        munmap(mapping, mappedSize);
+    }
+#endif
+    mapping = NULL;
+    mappedSize = 0;
+    buffer.clear();
+}
+
+/*---------------------------------------------------------------------------*/
+
+void FileContents::assign(std::string&& contents) {
+    release();
+    buffer = std::move(contents);
+}
+
+/*---------------------------------------------------------------------------*/
+
+// Read the whole file at once, with no intermediate stream buffer
+static JobStatus readContents(std::string& contents, const std::string& filename) {
+    std::ifstream ifs(filename.c_str(), std::ios::binary | std::ios::ate);
+    if (!ifs) {
+        error_return("File not found: %s", filename.c_str());
+    }
+    std::streamoff size = ifs.tellg();
+    if (size < 0) {
+        // Not seekable
+        ifs.clear();
+        contents.assign(std::istreambuf_iterator<char>(ifs), std::istreambuf_iterator<char>());
+        return EXIT_SUCCESS;
+    }
+    ifs.seekg(0);
+    contents.resize((size_t) size);
+    if (size > 0 && !ifs.read(&contents[0], size)) {
+        error_return("Cannot read file: %s", filename.c_str());
+    }
+    return EXIT_SUCCESS;
+}
+
+/*---------------------------------------------------------------------------*/
+
+JobStatus FileContents::load(const std::string& filename) {
+    TraceSpan span("readFile");
+    release();
+#ifndef _WIN32
+    int fd = open(filename.c_str(), O_RDONLY);
+    if (fd < 0) {
+        error_return("File not found: %s", filename.c_str());
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        close(fd);
+        error_return("Cannot read file: %s", filename.c_str());
+    }
+    // Empty files cannot be mapped, and neither can pipes and the like,
+    // which are read instead
+    if (S_ISREG(st.st_mode) && st.st_size > 0) {
+        void *data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data != MAP_FAILED) {
+            close(fd);
+            mapping = data;
+            mappedSize = (size_t) st.st_size;
+            return EXIT_SUCCESS;
+        }
+    }
+    close(fd);
+#endif
+    return readContents(buffer, filename);
+}
+
+/*---------------------------------------------------------------------------*/
+
+// rename() fails on Windows when the target exists
+
+static bool replaceFile(const std::string& from, const std::string& to) {
+#ifndef _WIN32
+    return rename(from.c_str(), to.c_str()) == 0;
+#else
+    return MoveFileExA(from.c_str(), to.c_str(), MOVEFILE_REPLACE_EXISTING) != 0;
+#endif
+}
+
+bool writeFileAtomic(const std::string& filename, const std::string& bytes) {
+    // Unique among the workers of a batch, and among the batches that
+    // share a directory
+    std::stringstream tmp;
+    tmp << filename << ".tmp" << std::this_thread::get_id();
+#ifndef _WIN32
+    tmp << "." << getpid();
+#else
+    tmp << "." << GetCurrentProcessId();
+#endif
+    std::ofstream ofs(tmp.str().c_str(), std::ios::binary);
+    ofs.write(bytes.data(), bytes.size());
+    ofs.close();
+    if (!ofs || !replaceFile(tmp.str(), filename)) {
+        remove(tmp.str().c_str());
+        return false;
+    }
+    return true;
+}
+
+/*---------------------------------------------------------------------------*/
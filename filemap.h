@@ -0,0 +1,48 @@
+#ifndef __GETIMAGE_FILEMAP__
+#define __GETIMAGE_FILEMAP__
+
+#include <string>
+
+#include "common.h"
+
+/*---------------------------------------------------------------------------*/
+// Input files, memory-mapped rather than copied, except on Windows where
+// they are read. The contents are not null-terminated: pass data() and
+// size() together, e.g. as the length of glShaderSource().
+/*---------------------------------------------------------------------------*/
+
+class FileContents {
+public:
+    FileContents() : mapping(NULL), mappedSize(0) {}
+    ~FileContents() { release(); }
+
+    JobStatus load(const std::string& filename);
+
+    // Replace the contents, e.g. with an edited copy
+    void assign(std::string&& contents);
+
+    const char *data() const { return mapping != NULL ? (const char *) mapping : buffer.data(); }
+    size_t size() const { return mapping != NULL ? mappedSize : buffer.size(); }
+    std::string str() const { return std::string(data(), size()); }
+
+private:
+    void release();
+
+    void *mapping;
+    size_t mappedSize;
+    std::string buffer;
+
+    FileContents(const FileContents&);
+    FileContents& operator=(const FileContents&);
+};
+
+/*---------------------------------------------------------------------------*/
+
+// Replace the contents of the file, or leave it as it was and return false.
+// Written to a file of our own then renamed, so that concurrent readers,
+// e.g. other batch workers, never see a partial file.
+bool writeFileAtomic(const std::string& filename, const std::string& bytes);
+
+/*---------------------------------------------------------------------------*/
+
+#endif
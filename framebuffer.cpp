@@ -0,0 +1,103 @@
+#include <algorithm>
+#include <string.h>
+
+#include "framebuffer.h"
+#include "openglcontext.h"
+#include "trace.h"
+
+/*---------------------------------------------------------------------------*/
+
+JobStatus framebufferInit(Framebuffer& fb, const Params& params) {
+    fb.fbo = 0;
+    fb.color = 0;
+    fb.width = 0;
+    fb.height = 0;
+    if (params.APIVersion < 300) {
+        error_return("Framebuffer objects need OpenGL or OpenGLES >= 3.0");
+    }
+
+    GLint maxRenderbuffer;
+    GLint maxViewport[2];
+    GL_SAFECALL(glGetIntegerv, GL_MAX_RENDERBUFFER_SIZE, &maxRenderbuffer);
+    GL_SAFECALL(glGetIntegerv, GL_MAX_VIEWPORT_DIMS, maxViewport);
+    fb.maxSize = std::min(maxRenderbuffer, std::min(maxViewport[0], maxViewport[1]));
+    if (params.tileSize > 0) {
+        fb.maxSize = std::min(fb.maxSize, params.tileSize);
+    }
+
+    GLuint fbo;
+    GLuint color;
+    GL_SAFECALL(glGenFramebuffers, 1, &fbo);
+    fb.fbo = fbo;
+    GL_SAFECALL(glGenRenderbuffers, 1, &color);
+    fb.color = color;
+    GL_SAFECALL(glBindFramebuffer, GL_FRAMEBUFFER, fbo);
+    GL_SAFECALL(glBindRenderbuffer, GL_RENDERBUFFER, color);
+    GL_SAFECALL(glFramebufferRenderbuffer, GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, color);
+    GL_CHECKSTAGE("framebuffer setup");
+    return EXIT_SUCCESS;
+}
+
+/*---------------------------------------------------------------------------*/
+
+bool framebufferTiled(const Framebuffer& fb, const Params& params) {
+    return params.width > fb.maxSize || params.height > fb.maxSize;
+}
+
+/*---------------------------------------------------------------------------*/
+
+// Like pbuffers, the renderbuffer only ever grows, so that jobs of varying
+// sizes do not reallocate it each time
+
+JobStatus framebufferBind(Framebuffer& fb, const Params& params, int width, int height) {
+    GL_SAFECALL(glBindFramebuffer, GL_FRAMEBUFFER, fb.fbo);
+    if (width <= fb.width && height <= fb.height) {
+        return EXIT_SUCCESS;
+    }
+    fb.width = std::max(width, fb.width);
+    fb.height = std::max(height, fb.height);
+    GL_SAFECALL(glBindRenderbuffer, GL_RENDERBUFFER, fb.color);
+    GL_SAFECALL(glRenderbufferStorage, GL_RENDERBUFFER, GL_RGBA8, fb.width, fb.height);
+    GL_CHECKSTAGE("framebuffer allocation");
+    GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+    if (status != GL_FRAMEBUFFER_COMPLETE) {
+        fb.width = 0;
+        fb.height = 0;
+        error_return("Incomplete framebuffer (0x%x)", status);
+    }
+    return EXIT_SUCCESS;
+}
+
+/*---------------------------------------------------------------------------*/
+
+JobStatus framebufferRead(const Params& params, int x, int y, int width, int height, std::vector<uint8_t>& data) {
+    size_t imageRow = (size_t) params.width * CHANNELS;
+    size_t tileRow = (size_t) width * CHANNELS;
+    uint8_t *out = &data[y * imageRow + x * CHANNELS];
+    TraceSpan span("glReadPixels");
+
+    if (width == params.width) {
+        GL_SAFECALL(glReadPixels, 0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, out);
+        return EXIT_SUCCESS;
+    }
+    std::vector<uint8_t> tile(tileRow * height);
+    GL_SAFECALL(glReadPixels, 0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, tile.data());
+    for (int h = 0; h < height; h++) {
+        memcpy(out + h * imageRow, &tile[h * tileRow], tileRow);
+    }
+    return EXIT_SUCCESS;
+}
+
+/*---------------------------------------------------------------------------*/
+
+void framebufferTerminate(Framebuffer& fb) {
+    GLuint fbo = fb.fbo;
+    GLuint color = fb.color;
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    glDeleteFramebuffers(1, &fbo);
+    glDeleteRenderbuffers(1, &color);
+    fb.fbo = 0;
+    fb.color = 0;
+}
+
+/*---------------------------------------------------------------------------*/
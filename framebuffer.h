@@ -0,0 +1,40 @@
+#ifndef __GETIMAGE_FRAMEBUFFER__
+#define __GETIMAGE_FRAMEBUFFER__
+
+#include <stdint.h>
+#include <vector>
+
+#include "common.h"
+
+/*---------------------------------------------------------------------------*/
+// Offscreen render target of a context, used with --fbo instead of the
+// window or pbuffer surface. Images larger than the implementation limits
+// are rendered in tiles of at most maxSize x maxSize pixels.
+/*---------------------------------------------------------------------------*/
+
+typedef struct {
+    uint32_t fbo;    // Are GLuint, but the OpenGL headers include this one
+    uint32_t color;  // Renderbuffer
+    int width;       // Size of the renderbuffer
+    int height;
+    int maxSize;
+} Framebuffer;
+
+// Needs OpenGL >= 3.0 or OpenGLES >= 3.0
+JobStatus framebufferInit(Framebuffer& fb, const Params& params);
+
+// Whether the params.width x params.height image needs several tiles
+bool framebufferTiled(const Framebuffer& fb, const Params& params);
+
+// Bind for drawing and reading, with at least width x height pixels
+JobStatus framebufferBind(Framebuffer& fb, const Params& params, int width, int height);
+
+// Read the width x height pixels at the origin of the framebuffer into
+// data, the RGBA8 image of params.width x params.height pixels, at x, y.
+JobStatus framebufferRead(const Params& params, int x, int y, int width, int height, std::vector<uint8_t>& data);
+
+void framebufferTerminate(Framebuffer& fb);
+
+/*---------------------------------------------------------------------------*/
+
+#endif
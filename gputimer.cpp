@@ -0,0 +1,100 @@
+#include <vector>
+
+#include "gputimer.h"
+#include "openglcontext.h"
+#include "openglext.h"
+
+/*---------------------------------------------------------------------------*/
+
+bool gpuTimerSupported(const Params& params) {
+    if (params.API == API_OPENGL) {
+        return params.APIVersion >= 330 || openglHasExtension(params, "GL_ARB_timer_query");
+    }
+    // The extension adds GL_TIME_ELAPSED_EXT to the core query functions
+    return params.APIVersion >= 300 && openglHasExtension(params, "GL_EXT_disjoint_timer_query");
+}
+
+/*---------------------------------------------------------------------------*/
+
+// On OpenGLES, a disjoint operation (e.g. a change of GPU frequency) makes
+// the queries that overlap it meaningless. Reading the flag clears it.
+
+static bool gpuDisjoint(const Params& params) {
+    if (params.API != API_OPENGL_ES) {
+        return false;
+    }
+    GLint disjoint = GL_FALSE;
+    glGetIntegerv(GL_GPU_DISJOINT_EXT, &disjoint);
+    return disjoint != GL_FALSE;
+}
+
+/*---------------------------------------------------------------------------*/
+
+static JobStatus timeDraws(const Params& params, JobStatus (*draw)(const Params&), std::vector<GLuint>& queries, std::vector<double>& samples) {
+    JobStatus status = EXIT_SUCCESS;
+    size_t issued = 0;
+    for (; issued < queries.size(); issued++) {
+        glBeginQuery(GL_TIME_ELAPSED_EXT, queries[issued]);
+        GL_CHECKERR("glBeginQuery");
+        status = draw(params);
+        glEndQuery(GL_TIME_ELAPSED_EXT);
+        if (status != EXIT_SUCCESS) {
+            break;
+        }
+        GL_CHECKERR("glEndQuery");
+    }
+
+    // Results of ended queries must be read even after a failure, so that
+    // they do not linger in the driver. Reading the last one waits for it.
+    samples.clear();
+    for (size_t i = 0; i < issued; i++) {
+        GLuint elapsed = 0;
+        glGetQueryObjectuiv(queries[i], GL_QUERY_RESULT, &elapsed);
+        samples.push_back(elapsed / 1000.0);
+    }
+    CHECK_STATUS(status);
+    GL_CHECKERR("glGetQueryObjectuiv");
+    return EXIT_SUCCESS;
+}
+
+/*---------------------------------------------------------------------------*/
+
+#define GPU_TIMER_ATTEMPTS (3)
+
+typedef struct {
+    const Params *params;
+    JobStatus (*draw)(const Params&);
+    std::vector<GLuint> *queries;
+} TimedDraws;
+
+static JobStatus timedRun(void *data, std::vector<double>& samples, bool& disjoint) {
+    TimedDraws *draws = (TimedDraws *) data;
+    gpuDisjoint(*draws->params);
+    JobStatus status = timeDraws(*draws->params, draws->draw, *draws->queries, samples);
+    disjoint = gpuDisjoint(*draws->params);
+    return status;
+}
+
+/*---------------------------------------------------------------------------*/
+
+JobStatus gpuTimeDraws(const Params& params, JobStatus (*draw)(const Params&), int repeats, GpuTimes& times) {
+    times.count = 0;
+    if (repeats < 1) {
+        return EXIT_SUCCESS;
+    }
+    if (!gpuTimerSupported(params)) {
+        error_return("GPU timer queries need OpenGL >= 3.3, GL_ARB_timer_query or GL_EXT_disjoint_timer_query");
+    }
+
+    std::vector<GLuint> queries(repeats);
+    GL_SAFECALL(glGenQueries, repeats, &queries[0]);
+
+    TimedDraws draws = { &params, draw, &queries };
+    JobStatus status = gpuTimesMeasure(timedRun, &draws, GPU_TIMER_ATTEMPTS, times);
+    glDeleteQueries(repeats, &queries[0]);
+    CHECK_STATUS(status);
+    GL_CHECKSTAGE("GPU timing");
+    return EXIT_SUCCESS;
+}
+
+/*---------------------------------------------------------------------------*/
@@ -0,0 +1,23 @@
+#ifndef __GETIMAGE_GPUTIMER__
+#define __GETIMAGE_GPUTIMER__
+
+#include "common.h"
+#include "gputimes.h"
+
+/*---------------------------------------------------------------------------*/
+// GPU time of the draws, measured with GL_TIME_ELAPSED queries rather than
+// glFinish() and the CPU clock, which stall the pipeline and mostly time
+// the round trip to the driver.
+/*---------------------------------------------------------------------------*/
+
+// Needs OpenGL >= 3.3 or GL_ARB_timer_query, or OpenGLES >= 3.0 with
+// GL_EXT_disjoint_timer_query
+bool gpuTimerSupported(const Params& params);
+
+// Time repeats calls of draw, one query each. All draws are issued before
+// any result is waited for, so that the GPU never idles between them.
+JobStatus gpuTimeDraws(const Params& params, JobStatus (*draw)(const Params&), int repeats, GpuTimes& times);
+
+/*---------------------------------------------------------------------------*/
+
+#endif
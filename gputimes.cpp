@@ -0,0 +1,42 @@
+#include <algorithm>
+
+#include "gputimes.h"
+
+/*---------------------------------------------------------------------------*/
+
+// Nearest rank percentile of sorted samples
+
+static double percentile(const std::vector<double>& sorted, int percent) {
+    size_t rank = (sorted.size() * percent + 99) / 100;
+    return sorted[std::max(rank, (size_t) 1) - 1];
+}
+
+void gpuTimesCompute(std::vector<double>& samples, GpuTimes& times) {
+    times.count = (int) samples.size();
+    if (samples.empty()) {
+        return;
+    }
+    std::sort(samples.begin(), samples.end());
+    times.min = samples.front();
+    times.median = percentile(samples, 50);
+    times.p95 = percentile(samples, 95);
+    times.max = samples.back();
+}
+
+/*---------------------------------------------------------------------------*/
+
+JobStatus gpuTimesMeasure(GpuTimedRun run, void *data, int attempts, GpuTimes& times) {
+    times.count = 0;
+    std::vector<double> samples;
+    bool disjoint = true;
+    for (int attempt = 0; attempt < attempts && disjoint; attempt++) {
+        CHECK_STATUS(run(data, samples, disjoint));
+    }
+    if (disjoint) {
+        error_return("GPU timer kept being disjoint, no reliable time");
+    }
+    gpuTimesCompute(samples, times);
+    return EXIT_SUCCESS;
+}
+
+/*---------------------------------------------------------------------------*/
@@ -0,0 +1,35 @@
+#ifndef __GETIMAGE_GPUTIMES__
+#define __GETIMAGE_GPUTIMES__
+
+#include <vector>
+
+#include "common.h"
+
+/*---------------------------------------------------------------------------*/
+// Statistics of the GPU timer samples, and the retries of disjoint runs,
+// apart from the queries themselves (see gputimer.h).
+/*---------------------------------------------------------------------------*/
+
+// In microseconds, over count draws
+typedef struct {
+    int count;
+    double min;
+    double median;
+    double p95;
+    double max;
+} GpuTimes;
+
+// Nearest rank statistics; sorts samples
+void gpuTimesCompute(std::vector<double>& samples, GpuTimes& times);
+
+// One timed run of the draws: its samples, and whether a disjoint
+// operation overlapped it, which makes them meaningless
+typedef JobStatus (*GpuTimedRun)(void *data, std::vector<double>& samples, bool& disjoint);
+
+// Repeat run until it is not disjoint, at most attempts times, and compute
+// the times of its samples. Fails when run does, or stays disjoint.
+JobStatus gpuTimesMeasure(GpuTimedRun run, void *data, int attempts, GpuTimes& times);
+
+/*---------------------------------------------------------------------------*/
+
+#endif
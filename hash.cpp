@@ -0,0 +1,160 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "hash.h"
+
+/*---------------------------------------------------------------------------*/
+
+static const uint64_t PRIME1 = 11400714785074694791ULL;
+static const uint64_t PRIME2 = 14029467366897019727ULL;
+static const uint64_t PRIME3 =  1609587929392839161ULL;
+static const uint64_t PRIME4 =  9650029242287828579ULL;
+static const uint64_t PRIME5 =  2870177450012600261ULL;
+
+/*---------------------------------------------------------------------------*/
+
+static inline uint64_t rotl(uint64_t x, int r) {
+    return (x << r) | (x >> (64 - r));
+}
+
+// Unaligned little-endian reads; all our targets are little-endian
+static inline uint64_t read64(const uint8_t *p) {
+    uint64_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline uint32_t read32(const uint8_t *p) {
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline uint64_t round(uint64_t acc, uint64_t input) {
+    acc += input * PRIME2;
+    acc = rotl(acc, 31);
+    return acc * PRIME1;
+}
+
+static inline uint64_t mergeRound(uint64_t acc, uint64_t val) {
+    acc ^= round(0, val);
+    return acc * PRIME1 + PRIME4;
+}
+
+/*---------------------------------------------------------------------------*/
+
+void hash64Init(Hash64State& state, uint64_t seed) {
+    state.v[0] = seed + PRIME1 + PRIME2;
+    state.v[1] = seed + PRIME2;
+    state.v[2] = seed;
+    state.v[3] = seed - PRIME1;
+    state.seed = seed;
+    state.total = 0;
+    state.buffered = 0;
+}
+
+/*---------------------------------------------------------------------------*/
+
+static inline void consume32(uint64_t *v, const uint8_t *p) {
+    v[0] = round(v[0], read64(p));
+    v[1] = round(v[1], read64(p + 8));
+    v[2] = round(v[2], read64(p + 16));
+    v[3] = round(v[3], read64(p + 24));
+}
+
+void hash64Update(Hash64State& state, const void *data, size_t length) {
+    const uint8_t *p = (const uint8_t *) data;
+    const uint8_t *end = p + length;
+    state.total += length;
+
+    // Complete the stripe left over by the previous update first
+    if (state.buffered > 0) {
+        size_t n = 32 - state.buffered;
+        if (n > length) {
+            n = length;
+        }
+        memcpy(state.buffer + state.buffered, p, n);
+        state.buffered += n;
+        p += n;
+        if (state.buffered < 32) {
+            return;
+        }
+        consume32(state.v, state.buffer);
+        state.buffered = 0;
+    }
+    while (p + 32 <= end) {
+        consume32(state.v, p);
+        p += 32;
+    }
+    memcpy(state.buffer, p, end - p);
+    state.buffered = end - p;
+}
+
+/*---------------------------------------------------------------------------*/
+
+uint64_t hash64Final(const Hash64State& state) {
+    const uint8_t *p = state.buffer;
+    const uint8_t *end = p + state.buffered;
+    uint64_t h;
+
+    if (state.total >= 32) {
+        const uint64_t *v = state.v;
+        h = rotl(v[0], 1) + rotl(v[1], 7) + rotl(v[2], 12) + rotl(v[3], 18);
+        h = mergeRound(h, v[0]);
+        h = mergeRound(h, v[1]);
+        h = mergeRound(h, v[2]);
+        h = mergeRound(h, v[3]);
+    } else {
+        h = state.seed + PRIME5;
+    }
+
+    h += state.total;
+
+    while (p + 8 <= end) {
+        h ^= round(0, read64(p));
+        h = rotl(h, 27) * PRIME1 + PRIME4;
+        p += 8;
+    }
+    if (p + 4 <= end) {
+        h ^= (uint64_t) read32(p) * PRIME1;
+        h = rotl(h, 23) * PRIME2 + PRIME3;
+        p += 4;
+    }
+    while (p < end) {
+        h ^= (*p) * PRIME5;
+        h = rotl(h, 11) * PRIME1;
+        p++;
+    }
+
+    h ^= h >> 33;
+    h *= PRIME2;
+    h ^= h >> 29;
+    h *= PRIME3;
+    h ^= h >> 32;
+    return h;
+}
+
+/*---------------------------------------------------------------------------*/
+
+uint64_t hash64(const void *data, size_t length, uint64_t seed) {
+    Hash64State state;
+    hash64Init(state, seed);
+    hash64Update(state, data, length);
+    return hash64Final(state);
+}
+
+/*---------------------------------------------------------------------------*/
+
+uint64_t hash64(const std::string& s, uint64_t seed) {
+    return hash64(s.data(), s.size(), seed);
+}
+
+/*---------------------------------------------------------------------------*/
+
+std::string hashToString(uint64_t hash) {
+    char buf[17];
+    snprintf(buf, sizeof(buf), "%016llx", (unsigned long long) hash);
+    return std::string(buf);
+}
+
+/*---------------------------------------------------------------------------*/
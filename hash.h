@@ -0,0 +1,35 @@
+#ifndef __GETIMAGE_HASH__
+#define __GETIMAGE_HASH__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+
+/*---------------------------------------------------------------------------*/
+
+// 64-bit xxHash (XXH64). Not cryptographic, but fast enough to hash whole
+// framebuffers, and good enough to key caches. Pass the previous hash as
+// seed to hash several pieces one after the other.
+
+uint64_t hash64(const void *data, size_t length, uint64_t seed = 0);
+uint64_t hash64(const std::string& s, uint64_t seed = 0);
+
+// Same hash, of data given in several pieces
+typedef struct {
+    uint64_t v[4];
+    uint64_t seed;
+    uint64_t total;
+    uint8_t buffer[32];
+    size_t buffered;
+} Hash64State;
+
+void hash64Init(Hash64State& state, uint64_t seed = 0);
+void hash64Update(Hash64State& state, const void *data, size_t length);
+uint64_t hash64Final(const Hash64State& state);
+
+// 16 lowercase hexadecimal digits
+std::string hashToString(uint64_t hash);
+
+/*---------------------------------------------------------------------------*/
+
+#endif
@@ -1,21 +1,42 @@
+#include <algorithm>
 #include <iostream>
 #include <fstream>
 #include <sstream>
 #include <vector>
 #include <ctime>
 #include <chrono>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <ctype.h>
+#include <string.h>
+
+#ifndef _WIN32
+#include <dirent.h>
+#else
+#include <windows.h>
+#endif
 
 #include "common.h"
+#include "bench.h"
+#include "filemap.h"
+#include "gputimer.h"
+#include "memo.h"
 #include "openglcontext.h"
-#include "lodepng.h"
+#include "openglext.h"
+#include "output.h"
+#include "hash.h"
+#include "progcache.h"
+#include "readback.h"
+#include "trace.h"
+#include "uniformfile.h"
+#include "workqueue.h"
 #include "json.hpp"
 using json = nlohmann::json;
 using namespace std::chrono;
 
-// These codes mimic the ones used in 'get-image-glfw'
-#define COMPILE_ERROR_EXIT_CODE (101)
-#define LINK_ERROR_EXIT_CODE (102)
-
 /*---------------------------------------------------------------------------*/
 // Parameters, argument parsing
 /*---------------------------------------------------------------------------*/
@@ -24,25 +45,74 @@ static void defaultParams(Params& params) {
     params.width = 256;
     params.height = 256;
     params.shaderVersion = 0;
+    params.shaderProfile = PROFILE_NONE;
     params.APIVersion = 0;
     params.fragFilename = "";
     params.vertFilename = "";
+    params.jsonFilename = "";
     params.output = "output.png";
+    params.batchFilename = "";
+    params.benchDir = "";
+    params.benchRepeats = 3;
+    params.workers = 1;
+    params.parallelCompile = 1;
+    params.programCache = "";
+    params.memoDir = "";
+    params.memoKey = "";
+    params.memoHit = false;
+    params.contextCache = "";
+    params.device = DEVICE_DEFAULT;
+    params.programCacheKey = "";
+    params.programCached = false;
+    params.asyncReadback = 0;
+    params.pngThreads = 0;
+    params.pngLevel = PNG_LEVEL_DEFAULT;
+    params.outputFormat = OUTPUT_PNG;
+    params.flip = true;
+    params.outputOffset = 0;
+    params.hashImage = false;
+    params.reference = "";
+    params.tolerance = 0;
+    params.fboFormat = FBO_NONE;
+    params.glErrors = GL_ERRORS_STRICT;
+    params.tileSize = 0;
     params.program = 0;
+    params.vertexShader = 0;
+    params.fragmentShader = 0;
+    params.uniformBuffer = 0;
     params.exitCompile = false;
     params.exitLinking = false;
     params.persist = false;
     params.animate = false;
     params.profile = false;
+    params.gpuTimeRepeats = 0;
+    params.compileTime = -1;
+    params.linkTime = -1;
+    params.renderTime = -1;
+    params.readbackTime = -1;
+    params.encodeTime = -1;
+    params.metricsFd = -1;
     params.timeVarName = "time";
-    params.delay = 5;
+    params.timeLocation = -1;
+    params.sequenceFrames = 0;
+    params.variantsFilename = "";
+    params.variantsDrawn = 0;
+    params.atlas = false;
+    params.timeStart = 0.0;
+    params.timeStep = 1.0 / 60.0;
+    params.captureEvery = 1;
+    params.frameTime = 0.0;
+    params.delay = 0;
+    params.framesDrawn = 0;
     params.binOut = "";
+    params.traceFile = "";
 }
 
 /*---------------------------------------------------------------------------*/
 
 static void usage(char *name) {
     std::cout << "Usage: " << name << " [options] <shader>.frag" << std::endl;
+    std::cout << "       " << name << " [options] --batch <jobs.jsonl>" << std::endl;
     std::cout << std::endl;
 
     const char *msg =
@@ -50,6 +120,16 @@ static void usage(char *name) {
         "shader as '<shader>.json'. This JSON file can contain uniforms\n"
         "initialisations. If no JSON file is found, the program uses default\n"
         "values for some uniforms.\n"
+        "\n"
+        "In batch mode, jobs are read one per line from the given file (or\n"
+        "stdin when the file is '-') as JSON objects of the form:\n"
+        "  {\"shader\": \"a.frag\", \"json\": \"a.json\", \"output\": \"a.png\",\n"
+        "   \"resolution\": [256, 256], \"reference\": \"ref.png\",\n"
+        "   \"variants\": \"a.jsonl\"}\n"
+        "Only \"shader\" is mandatory. All jobs are rendered with the same\n"
+        "OpenGL context, and one JSON result line is printed per job, with\n"
+        "a \"status\" field using the return values below, and the number of\n"
+        "frames drawn in \"frames\".\n"
         ;
     std::cout << msg;
     std::cout << std::endl;
@@ -57,15 +137,44 @@ static void usage(char *name) {
     std::cout << "Options:" << std::endl;
 
     const char *options[] = {
-        "--delay", "number of frames before PNG capture",
+        "--delay", "number of frames before capture (default: 1, or 5 with --animate)",
+        "--frames <n>", "render frames 0 to n-1 with the time uniform at t0 + i * dt, writing file_00000.png... or consecutive mmap images",
+        "--time <t0> <dt>", "with --frames, time of the first frame and between frames (default: 0 and 1/60)",
+        "--capture-every <k>", "with --frames, only write every kth frame (default 1)",
+        "--variants <file.jsonl>", "render the shader once per uniform set of the file, writing file_00000.png... or consecutive mmap images",
         "--persist", "instruct the renderer to not quit after producing the image",
         "--exit-compile", "exit after compilation",
         "--exit-linking", "exit after linking",
-        "--output file.png", "set PNG output file name",
+        "--output file.png", "set output file name",
         "--resolution <width> <height>", "set viewport resolution, in Pixels",
         "--vertex shader.vert", "use a specific vertex shader",
     	"--dump-bin <file>", "dump binary output to given file (requires OpenGL >= 4.1, OpenGLES >= 3.0)",
-        "--profile", "report time needed to compile, link and render",
+        "--profile", "report time needed to compile, link, render and encode the PNG",
+        "--trace <file.json>", "write the time spent in each stage, on each thread, as a Chrome trace",
+        "--metrics-fd <fd>", "write one JSON record per job, with timings, info logs and driver strings, to file descriptor fd",
+        "--gpu-time <n>", "after capture, time n draws with GPU timer queries, and report them with the CPU compile and link times",
+        "--batch <file>", "render all jobs listed in file ('-' for stdin)",
+        "--bench <dir>", "render every .frag shader of dir, and report throughput and stage latencies",
+        "--bench-repeats <k>", "with --bench, render each shader k times (default 3)",
+        "--workers <n>", "in batch mode, render with n threads, each with its own context (EGL only)",
+        "--parallel-compile <n>", "in batch mode, compile up to n shaders in the background (GL_KHR_parallel_shader_compile)",
+        "--program-cache <dir>", "reuse program binaries saved in the existing directory dir",
+        "--memo <dir>", "in batch mode, reuse the results, kept in the existing directory dir, of shaders identical up to comments and whitespace",
+        "--device <n|all>", "render on EGL device n, or with --workers, on all devices in turn (headless only)",
+        "--context-cache <file>", "save the context versions probed, to create the right one at once next time (GLFW only)",
+        "--async-readback <n>", "in batch mode, read images back through n pixel buffers, saving them while later jobs render",
+        "--png-threads <n>", "in batch mode, encode and write images on n background threads",
+        "--png-level <level>", "PNG compression: fast, default or store (uncompressed)",
+        "--format <format>", "output format: png, raw, ppm, pam or mmap (raw images written into the existing output file)",
+        "--offset <n>", "with mmap, write the image at byte n of the output file (first image in batch mode)",
+        "--no-flip", "with raw and mmap, keep rows in OpenGL order, bottom row first",
+        "--hash", "print the xxHash64 of the RGBA pixels",
+        "--reference <file.png|hash>", "compare the image to a PNG or a hash, and only write it if they differ",
+        "--tolerance <n>", "with a reference PNG, largest channel difference of matching images (default 0)",
+        "--fbo <format>", "render offscreen to a framebuffer of the given format (rgba8), in tiles if too large",
+        "--tile-size <n>", "with --fbo, render in tiles of at most n x n pixels",
+        "--atlas", "with --fbo, draw the variants side by side and read them back at once",
+        "--gl-errors <policy>", "check OpenGL errors after each call (strict, the default), once per stage (deferred), or with GL_KHR_debug (debug)",
     };
 
     for (unsigned i = 0; i < (sizeof(options) / sizeof(*options)); i++) {
@@ -81,6 +190,7 @@ static void usage(char *name) {
         "1", "Error",
         "101", "Shader compilation error (either fragment or vertex)",
         "102", "Shader linking error",
+        "103", "Image differs from the reference",
     };
 
     for (unsigned i = 0; i < (sizeof(errcode) / sizeof(*errcode)); i++) {
@@ -105,10 +215,63 @@ static void setParams(Params& params, int argc, char *argv[]) {
                 params.exitLinking = true;
             } else if (arg == "--persist") {
                 params.persist = true;
+            } else if (arg == "--no-flip") {
+                params.flip = false;
+            } else if (arg == "--hash") {
+                params.hashImage = true;
+            } else if (arg == "--reference") {
+                if ((i + 1) >= argc) { usage(argv[0]); crash("Missing value for option %s", "--reference"); }
+                params.reference = argv[++i];
+            } else if (arg == "--tolerance") {
+                if ((i + 1) >= argc) { usage(argv[0]); crash("Missing value for option %s", "--tolerance"); }
+                params.tolerance = atoi(argv[++i]);
+            } else if (arg == "--fbo") {
+                if ((i + 1) >= argc) { usage(argv[0]); crash("Missing value for option %s", "--fbo"); }
+                std::string format = argv[++i];
+                if (format == "rgba8") {
+                    params.fboFormat = FBO_RGBA8;
+                } else {
+                    crash("Invalid framebuffer format: %s", argv[i]);
+                }
+            } else if (arg == "--gl-errors") {
+                if ((i + 1) >= argc) { usage(argv[0]); crash("Missing value for option %s", "--gl-errors"); }
+                std::string policy = argv[++i];
+                if (policy == "strict") {
+                    params.glErrors = GL_ERRORS_STRICT;
+                } else if (policy == "deferred") {
+                    params.glErrors = GL_ERRORS_DEFERRED;
+                } else if (policy == "debug") {
+                    params.glErrors = GL_ERRORS_DEBUG;
+                } else {
+                    crash("Invalid OpenGL error policy: %s", argv[i]);
+                }
+            } else if (arg == "--tile-size") {
+                if ((i + 1) >= argc) { usage(argv[0]); crash("Missing value for option %s", "--tile-size"); }
+                params.tileSize = atoi(argv[++i]);
+                if (params.tileSize < 1) {
+                    crash("Invalid tile size: %s", argv[i]);
+                }
+            } else if (arg == "--atlas") {
+                params.atlas = true;
             } else if (arg == "--animate") {
                 params.animate = true;
             } else if (arg == "--profile") {
                 params.profile = true;
+            } else if (arg == "--trace") {
+                if ((i + 1) >= argc) { usage(argv[0]); crash("Missing value for option %s", "--trace"); }
+                params.traceFile = argv[++i];
+            } else if (arg == "--metrics-fd") {
+                if ((i + 1) >= argc) { usage(argv[0]); crash("Missing value for option %s", "--metrics-fd"); }
+                params.metricsFd = atoi(argv[++i]);
+                if (params.metricsFd < 0) {
+                    crash("Invalid file descriptor: %s", argv[i]);
+                }
+            } else if (arg == "--gpu-time") {
+                if ((i + 1) >= argc) { usage(argv[0]); crash("Missing value for option %s", "--gpu-time"); }
+                params.gpuTimeRepeats = atoi(argv[++i]);
+                if (params.gpuTimeRepeats < 1) {
+                    crash("Invalid number of timed draws: %s", argv[i]);
+                }
             } else if (arg == "--delay") {
                 if ((i + 1) >= argc) { usage(argv[0]); crash("Missing value for option %s", "--delay"); }
                 params.delay = atoi(argv[++i]);
@@ -125,6 +288,114 @@ static void setParams(Params& params, int argc, char *argv[]) {
             } else if (arg == "--dump-bin") {
                 if ((i + 1) >= argc) { usage(argv[0]); crash("Missing value for option %s", "--dump-bin"); }
                 params.binOut = argv[++i];
+            } else if (arg == "--batch") {
+                if ((i + 1) >= argc) { usage(argv[0]); crash("Missing value for option %s", "--batch"); }
+                params.batchFilename = argv[++i];
+            } else if (arg == "--bench") {
+                if ((i + 1) >= argc) { usage(argv[0]); crash("Missing value for option %s", "--bench"); }
+                params.benchDir = argv[++i];
+            } else if (arg == "--bench-repeats") {
+                if ((i + 1) >= argc) { usage(argv[0]); crash("Missing value for option %s", "--bench-repeats"); }
+                params.benchRepeats = atoi(argv[++i]);
+                if (params.benchRepeats < 1) {
+                    crash("Invalid number of repeats: %s", argv[i]);
+                }
+            } else if (arg == "--workers") {
+                if ((i + 1) >= argc) { usage(argv[0]); crash("Missing value for option %s", "--workers"); }
+                params.workers = atoi(argv[++i]);
+                if (params.workers < 1) {
+                    crash("Invalid number of workers: %s", argv[i]);
+                }
+            } else if (arg == "--parallel-compile") {
+                if ((i + 1) >= argc) { usage(argv[0]); crash("Missing value for option %s", "--parallel-compile"); }
+                params.parallelCompile = atoi(argv[++i]);
+                if (params.parallelCompile < 1) {
+                    crash("Invalid number of parallel compilations: %s", argv[i]);
+                }
+            } else if (arg == "--context-cache") {
+                if ((i + 1) >= argc) { usage(argv[0]); crash("Missing value for option %s", "--context-cache"); }
+                params.contextCache = argv[++i];
+            } else if (arg == "--device") {
+                if ((i + 1) >= argc) { usage(argv[0]); crash("Missing value for option %s", "--device"); }
+                std::string device = argv[++i];
+                if (device == "all") {
+                    params.device = DEVICE_ALL;
+                } else {
+                    params.device = atoi(argv[i]);
+                    if (params.device < 0 || !isdigit((unsigned char) device[0])) {
+                        crash("Invalid device: %s", argv[i]);
+                    }
+                }
+            } else if (arg == "--program-cache") {
+                if ((i + 1) >= argc) { usage(argv[0]); crash("Missing value for option %s", "--program-cache"); }
+                params.programCache = argv[++i];
+            } else if (arg == "--memo") {
+                if ((i + 1) >= argc) { usage(argv[0]); crash("Missing value for option %s", "--memo"); }
+                params.memoDir = argv[++i];
+                // Memoized images are told apart by their hash
+                params.hashImage = true;
+            } else if (arg == "--async-readback") {
+                if ((i + 1) >= argc) { usage(argv[0]); crash("Missing value for option %s", "--async-readback"); }
+                params.asyncReadback = atoi(argv[++i]);
+                if (params.asyncReadback < 0) {
+                    crash("Invalid number of readback buffers: %s", argv[i]);
+                }
+            } else if (arg == "--png-threads") {
+                if ((i + 1) >= argc) { usage(argv[0]); crash("Missing value for option %s", "--png-threads"); }
+                params.pngThreads = atoi(argv[++i]);
+                if (params.pngThreads < 0) {
+                    crash("Invalid number of PNG threads: %s", argv[i]);
+                }
+            } else if (arg == "--png-level") {
+                if ((i + 1) >= argc) { usage(argv[0]); crash("Missing value for option %s", "--png-level"); }
+                std::string level = argv[++i];
+                if (level == "fast") {
+                    params.pngLevel = PNG_LEVEL_FAST;
+                } else if (level == "default") {
+                    params.pngLevel = PNG_LEVEL_DEFAULT;
+                } else if (level == "store") {
+                    params.pngLevel = PNG_LEVEL_STORE;
+                } else {
+                    crash("Invalid PNG level: %s", argv[i]);
+                }
+            } else if (arg == "--format") {
+                if ((i + 1) >= argc) { usage(argv[0]); crash("Missing value for option %s", "--format"); }
+                std::string format = argv[++i];
+                if (format == "png") {
+                    params.outputFormat = OUTPUT_PNG;
+                } else if (format == "raw") {
+                    params.outputFormat = OUTPUT_RAW;
+                } else if (format == "ppm") {
+                    params.outputFormat = OUTPUT_PPM;
+                } else if (format == "pam") {
+                    params.outputFormat = OUTPUT_PAM;
+                } else if (format == "mmap") {
+                    params.outputFormat = OUTPUT_MMAP;
+                } else {
+                    crash("Invalid output format: %s", argv[i]);
+                }
+            } else if (arg == "--offset") {
+                if ((i + 1) >= argc) { usage(argv[0]); crash("Missing value for option %s", "--offset"); }
+                params.outputOffset = strtoull(argv[++i], NULL, 0);
+            } else if (arg == "--frames") {
+                if ((i + 1) >= argc) { usage(argv[0]); crash("Missing value for option %s", "--frames"); }
+                params.sequenceFrames = atoi(argv[++i]);
+                if (params.sequenceFrames < 1) {
+                    crash("Invalid number of frames: %s", argv[i]);
+                }
+            } else if (arg == "--time") {
+                if ((i + 2) >= argc) { usage(argv[0]); crash("Missing value for option %s", "--time"); }
+                params.timeStart = atof(argv[++i]);
+                params.timeStep = atof(argv[++i]);
+            } else if (arg == "--capture-every") {
+                if ((i + 1) >= argc) { usage(argv[0]); crash("Missing value for option %s", "--capture-every"); }
+                params.captureEvery = atoi(argv[++i]);
+                if (params.captureEvery < 1) {
+                    crash("Invalid capture interval: %s", argv[i]);
+                }
+            } else if (arg == "--variants") {
+                if ((i + 1) >= argc) { usage(argv[0]); crash("Missing value for option %s", "--variants"); }
+                params.variantsFilename = argv[++i];
             } else if (arg == "--timevar-name") {
                 if ((i + 1) >= argc) { usage(argv[0]); crash("Missing value for option %s", "--timevar-name"); }
                 params.timeVarName = argv[++i];
@@ -142,6 +413,23 @@ static void setParams(Params& params, int argc, char *argv[]) {
         }
     }
 
+    if (params.atlas && params.fboFormat == FBO_NONE) {
+        usage(argv[0]);
+        crash("--atlas needs --fbo");
+    }
+
+    if (params.batchFilename != "" || params.benchDir != "") {
+        if (params.batchFilename != "" && params.benchDir != "") {
+            usage(argv[0]);
+            crash("--batch and --bench are exclusive");
+        }
+        if (params.fragFilename != "") {
+            usage(argv[0]);
+            crash("Unexpected fragment shader argument in batch mode: %s", params.fragFilename.c_str());
+        }
+        return;
+    }
+
     if (params.fragFilename == "") {
         usage(argv[0]);
         crash("Missing fragment shader argument");
@@ -167,6 +455,21 @@ void printAPI(const Params& params) {
     printf(" %d.%d", major, minor);
 }
 
+/*---------------------------------------------------------------------------*/
+
+// Driver strings of the current context, for the job records
+
+static std::string glString(GLenum name) {
+    const char *s = (const char *) glGetString(name);
+    return s != NULL ? s : "";
+}
+
+static void getDriverStrings(Params& params) {
+    params.glVendor = glString(GL_VENDOR);
+    params.glRenderer = glString(GL_RENDERER);
+    params.glVersion = glString(GL_VERSION);
+}
+
 /*---------------------------------------------------------------------------*/
 // Helpers
 /*---------------------------------------------------------------------------*/
@@ -178,50 +481,127 @@ bool isFile(std::string filename) {
 
 /*---------------------------------------------------------------------------*/
 
-void readFile(std::string& contents, const std::string& filename) {
-    std::ifstream ifs(filename.c_str());
-    if(!ifs) {
-        crash("File not found: %s", filename.c_str());
+std::string getJSONFilename(const Params& params) {
+    if (params.jsonFilename != "") {
+        return params.jsonFilename;
     }
-    std::stringstream ss;
-    ss << ifs.rdbuf();
-    contents = ss.str();
+    std::string jsonFilename(params.fragFilename);
+    jsonFilename.replace(jsonFilename.end()-4, jsonFilename.end(), "json");
+    return jsonFilename;
+}
+
+/*---------------------------------------------------------------------------*/
+
+static bool isIdentifierChar(char c) {
+    return isalnum((unsigned char) c) || c == '_';
+}
+
+// Skip blanks and comments, which may precede the #version directive.
+// Newlines are only skipped if multiline.
+
+static const char *skipBlanks(const char *p, const char *end, bool multiline) {
+    while (p < end) {
+        if (*p == ' ' || *p == '\t' || *p == '\r' || (multiline && *p == '\n')) {
+            p++;
+        } else if (p + 1 < end && p[0] == '/' && p[1] == '/') {
+            while (p < end && *p != '\n') {
+                p++;
+            }
+        } else if (p + 1 < end && p[0] == '/' && p[1] == '*') {
+            p += 2;
+            while (p + 1 < end && !(p[0] == '*' && p[1] == '/')) {
+                p++;
+            }
+            p = std::min(p + 2, end);
+        } else {
+            break;
+        }
+    }
+    return p;
+}
+
+static bool isWord(const char *p, const char *end, const char *word) {
+    size_t n = strlen(word);
+    return (size_t) (end - p) >= n && memcmp(p, word, n) == 0 &&
+        (p + n == end || !isIdentifierChar(p[n]));
 }
 
 /*---------------------------------------------------------------------------*/
 
-int getShaderVersion(const std::string& fragContents) {
-    size_t pos = fragContents.find('\n');
-    if (pos == std::string::npos) {
-        crash("cannot find end-of-line in fragment shader");
+// Parse the #version directive in one pass over the source, without any
+// allocation: it runs for every job in batch mode.
+
+JobStatus getShaderVersion(int& version, SHADER_PROFILE& profile, const FileContents& fragContents) {
+    TraceSpan span("getShaderVersion");
+    const char *p = fragContents.data();
+    const char *end = p + fragContents.size();
+
+    p = skipBlanks(p, end, true);
+    const char *directive = p;
+    const char *eol = (const char *) memchr(p, '\n', end - p);
+    int lineLength = (int) std::min<ptrdiff_t>((eol != NULL ? eol : end) - directive, 80);
+    if (p == end || *p != '#') {
+        error_return("cannot find ``#version'' before the code of fragment shader");
+    }
+    p = skipBlanks(p + 1, end, false);
+    if (!isWord(p, end, "version")) {
+        error_return("cannot find ``#version'' before the code of fragment shader: ``%.*s''", lineLength, directive);
+    }
+    p = skipBlanks(p + 7, end, false);
+
+    version = 0;
+    const char *digits = p;
+    while (p < end && isdigit((unsigned char) *p) && p - digits < 4) {
+        version = version * 10 + (*p++ - '0');
+    }
+    if (p == digits || (p < end && isIdentifierChar(*p))) {
+        error_return("bad ``#version'' in fragment shader: ``%.*s''", lineLength, directive);
     }
-    std::string sub = fragContents.substr(0, pos);
-    if (std::string::npos == sub.find("#version")) {
-        crash("cannot find ``#version'' in first line of fragment shader");
+    p = skipBlanks(p, end, false);
+
+    profile = PROFILE_NONE;
+    if (isWord(p, end, "es")) {
+        profile = PROFILE_ES;
+        p += 2;
+    } else if (isWord(p, end, "core")) {
+        profile = PROFILE_CORE;
+        p += 4;
+    } else if (isWord(p, end, "compatibility")) {
+        profile = PROFILE_COMPATIBILITY;
+        p += 13;
+    }
+    p = skipBlanks(p, end, false);
+    if (p < end && *p != '\n') {
+        error_return("bad ``#version'' in fragment shader: ``%.*s''", lineLength, directive);
     }
 
-    // TODO: use sscanf of c++ equivalent
-    if (std::string::npos != sub.find("110")) { return 110; }
-    if (std::string::npos != sub.find("120")) { return 120; }
-    if (std::string::npos != sub.find("130")) { return 130; }
-    if (std::string::npos != sub.find("140")) { return 140; }
-    if (std::string::npos != sub.find("150")) { return 150; }
-    if (std::string::npos != sub.find("330")) { return 330; }
-    if (std::string::npos != sub.find("400")) { return 400; }
-    if (std::string::npos != sub.find("410")) { return 410; }
-    if (std::string::npos != sub.find("420")) { return 420; }
-    if (std::string::npos != sub.find("430")) { return 430; }
-    if (std::string::npos != sub.find("440")) { return 440; }
-    if (std::string::npos != sub.find("450")) { return 450; }
-    // The following are OpenGL ES
-    if (std::string::npos != sub.find("100")) { return 100; }
-    if (std::string::npos != sub.find("300")) { return 300; }
-    crash("Cannot find a supported GLSL version in first line of fragment shader: ``%.80s''", sub.c_str());
+    switch (version) {
+    case 100:
+        profile = PROFILE_ES;
+        return EXIT_SUCCESS;
+    case 300:
+        // Accepted without its mandatory "es", as it has always been
+        profile = PROFILE_ES;
+        return EXIT_SUCCESS;
+    case 310:
+    case 320:
+        if (profile == PROFILE_ES) {
+            return EXIT_SUCCESS;
+        }
+        break;
+    case 110: case 120: case 130: case 140: case 150:
+    case 330: case 400: case 410: case 420: case 430: case 440: case 450: case 460:
+        if (profile != PROFILE_ES) {
+            return EXIT_SUCCESS;
+        }
+        break;
+    }
+    error_return("Cannot find a supported GLSL version in fragment shader: ``%.*s''", lineLength, directive);
 }
 
 /*---------------------------------------------------------------------------*/
 
-void generateVertexShader(std::string& out, const Params& params) {
+JobStatus generateVertexShader(FileContents& out, const Params& params) {
     static const std::string vertGenericContents = std::string(
         "vec2 _GLF_vertexPosition;\n"
         "void main(void) {\n"
@@ -230,105 +610,280 @@ void generateVertexShader(std::string& out, const Params& params) {
         );
 
     if (params.vertFilename != "") {
-        readFile(out, params.vertFilename);
-        return;
+        return out.load(params.vertFilename);
     }
 
+    // Same version and profile as the fragment shader. From versions 300
+    // es and 130, _GLF_vertexPosition is qualified as "in" rather than
+    // "attribute", which core profiles do not have.
+    bool es = params.shaderProfile == PROFILE_ES;
     std::stringstream ss;
     ss << "#version " << params.shaderVersion;
-    if (params.shaderVersion == 300) {
-        // Version 300 must have the "es" suffix, and qualifies the
-        // _GLF_vertexPosition as "in" rather than "attribute"
-        ss << " es" << std::endl << "in ";
+    if (es && params.shaderVersion >= 300) {
+        ss << " es";
+    } else if (params.shaderProfile == PROFILE_CORE) {
+        ss << " core";
+    } else if (params.shaderProfile == PROFILE_COMPATIBILITY) {
+        ss << " compatibility";
+    }
+    ss << std::endl;
+    if (params.shaderVersion >= (es ? 300 : 130)) {
+        ss << "in ";
     } else {
-        ss << std::endl << "attribute ";
+        ss << "attribute ";
     }
     ss << vertGenericContents;
-    out = ss.str();
+    out.assign(ss.str());
 
-    //std::cerr << "Generated vertex shader:\n" << out << std::endl;
+    //std::cerr << "Generated vertex shader:\n" << out.str() << std::endl;
+    return EXIT_SUCCESS;
 }
 
 /*---------------------------------------------------------------------------*/
 // JSON uniforms
 /*---------------------------------------------------------------------------*/
 
-static void setJSONDefaultEntries(json& j, const Params& params) {
-
-    json defaults = {
-        {"injectionSwitch", {
-                {"func", "glUniform2f"},
-                {"args", {0.0f, 1.0f}}
-            }},
-        {"time", {
-                {"func", "glUniform1f"},
-                {"args", {0.0f}}
-            }},
-        {"mouse", {
-                {"func", "glUniform2f"},
-                {"args", {0.0f, 0.0f}}
-            }},
-        {"resolution", {
-                {"func", "glUniform2f"},
-                {"args", {float(params.width), float(params.height)}}
-            }}
-    };
+static void setUniformDefaults(UniformSet& uniforms, const Params& params) {
+    uniformSetAdd(uniforms, "injectionSwitch", "glUniform2f", {0.0, 1.0});
+    uniformSetAdd(uniforms, "time", "glUniform1f", {0.0});
+    uniformSetAdd(uniforms, "mouse", "glUniform2f", {0.0, 0.0});
+    uniformSetAdd(uniforms, "resolution", "glUniform2f", {(double) params.width, (double) params.height});
+}
 
-    for (json::iterator it = defaults.begin(); it != defaults.end(); ++it) {
-        if (j.count(it.key()) == 0) {
-            j[it.key()] = it.value();
+/*---------------------------------------------------------------------------*/
+
+// Uniforms are set in two steps: the JSON entries are first compiled into a
+// plan, that holds the location, setter and values of each uniform, and the
+// plan is then applied with no more lookups or conversions. Members of
+// uniform blocks use the same JSON entries, but are packed at their
+// reflected offsets into a single buffer instead.
+
+typedef enum {
+    UNIFORM_1F, UNIFORM_2F, UNIFORM_3F, UNIFORM_4F,
+    UNIFORM_1I, UNIFORM_2I, UNIFORM_3I, UNIFORM_4I,
+    UNIFORM_1UI, UNIFORM_2UI, UNIFORM_3UI, UNIFORM_4UI,
+    UNIFORM_1FV, UNIFORM_2FV, UNIFORM_3FV, UNIFORM_4FV,
+    UNIFORM_1IV, UNIFORM_2IV, UNIFORM_3IV, UNIFORM_4IV
+} UniformOp;
+
+typedef enum {
+    UNIFORM_FLOAT,
+    UNIFORM_INT,
+    UNIFORM_UINT
+} UniformBase;
+
+typedef struct {
+    const char *name;
+    UniformOp op;
+    UniformBase base;
+    int components;
+    bool array;         // Any multiple of components values
+} UniformFunc;
+
+static const UniformFunc uniformFuncs[] = {
+    { "glUniform1f", UNIFORM_1F, UNIFORM_FLOAT, 1, false },
+    { "glUniform2f", UNIFORM_2F, UNIFORM_FLOAT, 2, false },
+    { "glUniform3f", UNIFORM_3F, UNIFORM_FLOAT, 3, false },
+    { "glUniform4f", UNIFORM_4F, UNIFORM_FLOAT, 4, false },
+    { "glUniform1i", UNIFORM_1I, UNIFORM_INT, 1, false },
+    { "glUniform2i", UNIFORM_2I, UNIFORM_INT, 2, false },
+    { "glUniform3i", UNIFORM_3I, UNIFORM_INT, 3, false },
+    { "glUniform4i", UNIFORM_4I, UNIFORM_INT, 4, false },
+    // Note: GLES does not provide glUniformXui primitives
+#ifndef GL_VERSION_ES_CM_1_0
+    { "glUniform1ui", UNIFORM_1UI, UNIFORM_UINT, 1, false },
+    { "glUniform2ui", UNIFORM_2UI, UNIFORM_UINT, 2, false },
+    { "glUniform3ui", UNIFORM_3UI, UNIFORM_UINT, 3, false },
+    { "glUniform4ui", UNIFORM_4UI, UNIFORM_UINT, 4, false },
+#endif // ifndef GL_VERSION_ES_CM_1_0
+    { "glUniform1fv", UNIFORM_1FV, UNIFORM_FLOAT, 1, true },
+    { "glUniform2fv", UNIFORM_2FV, UNIFORM_FLOAT, 2, true },
+    { "glUniform3fv", UNIFORM_3FV, UNIFORM_FLOAT, 3, true },
+    { "glUniform4fv", UNIFORM_4FV, UNIFORM_FLOAT, 4, true },
+    { "glUniform1iv", UNIFORM_1IV, UNIFORM_INT, 1, true },
+    { "glUniform2iv", UNIFORM_2IV, UNIFORM_INT, 2, true },
+    { "glUniform3iv", UNIFORM_3IV, UNIFORM_INT, 3, true },
+    { "glUniform4iv", UNIFORM_4IV, UNIFORM_INT, 4, true },
+};
+
+static const UniformFunc *findUniformFunc(const std::string& name) {
+    for (size_t i = 0; i < sizeof(uniformFuncs) / sizeof(uniformFuncs[0]); i++) {
+        if (name == uniformFuncs[i].name) {
+            return &uniformFuncs[i];
         }
     }
+    return NULL;
 }
 
+typedef struct {
+    GLint location;
+    const UniformFunc *func;
+    GLsizei count;      // Of vectors, for the array setters
+    size_t offset;      // In the arena of func->base
+} UniformBinding;
+
+typedef struct {
+    GLuint index;
+    size_t offset;      // In the uniform buffer
+    size_t size;
+} UniformBlock;
+
+// What the program tells of an active uniform, found once for all the
+// uniform sets it is drawn with
+
+typedef struct {
+    std::string name;
+    GLint location;     // -1 for block members
+    GLint blockIndex;   // -1 outside of blocks
+    GLint offset;       // In the block
+    GLint arrayStride;
+    GLint size;
+} ActiveUniform;
+
+typedef struct {
+    GLuint program;
+    std::vector<ActiveUniform> uniforms;
+    std::vector<UniformBlock> blocks;
+    size_t blockDataSize;
+} UniformLayout;
+
+typedef struct {
+    GLuint program;
+    std::vector<UniformBinding> bindings;
+    std::vector<GLfloat> floats;
+    std::vector<GLint> ints;
+    std::vector<GLuint> uints;
+    std::vector<UniformBlock> blocks;
+    std::vector<uint8_t> blockData;     // Contents of the uniform buffer
+} UniformPlan;
+
 /*---------------------------------------------------------------------------*/
 
-template<typename T>
-T *getArray(const json& j) {
-    T *a = new T[j.size()];
-    for (unsigned i = 0; i < j.size(); i++) {
-        a[i] = j[i];
+// Append the values to the arena of the binding, converted like the json
+// conversions do
+static void addUniformArgs(UniformPlan& plan, UniformBinding& binding, const std::vector<double>& args, size_t n) {
+    switch (binding.func->base) {
+    case UNIFORM_FLOAT:
+        binding.offset = plan.floats.size();
+        for (size_t i = 0; i < n; i++) {
+            plan.floats.push_back((GLfloat) args[i]);
+        }
+        break;
+    case UNIFORM_INT:
+        binding.offset = plan.ints.size();
+        for (size_t i = 0; i < n; i++) {
+            plan.ints.push_back((GLint) args[i]);
+        }
+        break;
+    case UNIFORM_UINT:
+        binding.offset = plan.uints.size();
+        for (size_t i = 0; i < n; i++) {
+            plan.uints.push_back((GLuint) (int64_t) args[i]);
+        }
+        break;
     }
-    return a;
 }
 
-/*---------------------------------------------------------------------------*/
+// Values of the binding, all of them 4 bytes wide
+static const uint8_t *uniformValues(const UniformPlan& plan, const UniformBinding& binding) {
+    switch (binding.func->base) {
+    case UNIFORM_FLOAT:
+        return (const uint8_t *) (plan.floats.data() + binding.offset);
+    case UNIFORM_INT:
+        return (const uint8_t *) (plan.ints.data() + binding.offset);
+    case UNIFORM_UINT:
+        break;
+    }
+    return (const uint8_t *) (plan.uints.data() + binding.offset);
+}
 
-#define GLUNIFORM_ARRAYINIT(funcname, uniformloc, gltype, jsonarray)    \
-    gltype *a = getArray<gltype>(jsonarray);                            \
-    funcname(uniformloc, jsonarray.size(), a);                          \
-    delete [] a
+static void dropUniformArgs(UniformPlan& plan, const UniformBinding& binding) {
+    switch (binding.func->base) {
+    case UNIFORM_FLOAT:
+        plan.floats.resize(binding.offset);
+        break;
+    case UNIFORM_INT:
+        plan.ints.resize(binding.offset);
+        break;
+    case UNIFORM_UINT:
+        plan.uints.resize(binding.offset);
+        break;
+    }
+}
 
 /*---------------------------------------------------------------------------*/
 
-void setUniformsJSON(const GLuint& program, const Params& params) {
-    GLint nbUniforms;
-    GL_SAFECALL(glGetProgramiv, program, GL_ACTIVE_UNIFORMS, &nbUniforms);
-    if (nbUniforms == 0) {
-        // If there are no uniforms to set, return now
-        return;
+// Reflect the uniform blocks and lay them out in one buffer. blockIndex,
+// offset and arrayStride receive the block layout of each active uniform.
+
+static JobStatus reflectUniformBlocks(UniformLayout& layout, GLint nbUniforms, std::vector<GLint>& blockIndex, std::vector<GLint>& offset, std::vector<GLint>& arrayStride) {
+    GLint nbBlocks;
+    GL_SAFECALL(glGetProgramiv, layout.program, GL_ACTIVE_UNIFORM_BLOCKS, &nbBlocks);
+    if (nbBlocks == 0) {
+        return EXIT_SUCCESS;
     }
 
-    // Read JSON file
-    std::string jsonFilename(params.fragFilename);
-    jsonFilename.replace(jsonFilename.end()-4, jsonFilename.end(), "json");
-    json j = json({});
-    if (isFile(jsonFilename)) {
-        std::string jsonContent;
-        readFile(jsonContent, jsonFilename);
-        j = json::parse(jsonContent);
-    } else {
-        // If and only if no JSON file, use the defaults
-        std::cerr << "Warning: file '" << jsonFilename << "' not found, will rely on default uniform values only" << std::endl;
-        setJSONDefaultEntries(j, params);
+    std::vector<GLuint> indices(nbUniforms);
+    for (GLint i = 0; i < nbUniforms; i++) {
+        indices[i] = (GLuint) i;
+    }
+    blockIndex.resize(nbUniforms);
+    offset.resize(nbUniforms);
+    arrayStride.resize(nbUniforms);
+    GL_SAFECALL(glGetActiveUniformsiv, layout.program, nbUniforms, indices.data(), GL_UNIFORM_BLOCK_INDEX, blockIndex.data());
+    GL_SAFECALL(glGetActiveUniformsiv, layout.program, nbUniforms, indices.data(), GL_UNIFORM_OFFSET, offset.data());
+    GL_SAFECALL(glGetActiveUniformsiv, layout.program, nbUniforms, indices.data(), GL_UNIFORM_ARRAY_STRIDE, arrayStride.data());
+
+    GLint alignment;
+    GLint maxBindings;
+    GL_SAFECALL(glGetIntegerv, GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &alignment);
+    GL_SAFECALL(glGetIntegerv, GL_MAX_UNIFORM_BUFFER_BINDINGS, &maxBindings);
+    if (nbBlocks > maxBindings) {
+        error_return("%d uniform blocks, but only %d uniform buffer bindings", nbBlocks, maxBindings);
     }
 
+    size_t size = 0;
+    layout.blocks.resize(nbBlocks);
+    for (GLint i = 0; i < nbBlocks; i++) {
+        GLint blockSize;
+        GL_SAFECALL(glGetActiveUniformBlockiv, layout.program, i, GL_UNIFORM_BLOCK_DATA_SIZE, &blockSize);
+        size = (size + alignment - 1) / alignment * alignment;
+        layout.blocks[i].index = (GLuint) i;
+        layout.blocks[i].offset = size;
+        layout.blocks[i].size = (size_t) blockSize;
+        size += (size_t) blockSize;
+    }
+    layout.blockDataSize = size;
+    return EXIT_SUCCESS;
+}
+
+/*---------------------------------------------------------------------------*/
+
+static JobStatus reflectUniforms(UniformLayout& layout, const GLuint& program, const Params& params) {
+    GLint nbUniforms;
+    GL_SAFECALL(glGetProgramiv, program, GL_ACTIVE_UNIFORMS, &nbUniforms);
+
     GLint uniformNameMaxLength = 0;
     GL_SAFECALL(glGetProgramiv, program, GL_ACTIVE_UNIFORM_MAX_LENGTH, &uniformNameMaxLength);
-    GLchar *uniformName = new GLchar[uniformNameMaxLength];
+    std::vector<GLchar> uniformNameBuffer((size_t) uniformNameMaxLength + 1, 0);
+    GLchar *uniformName = &uniformNameBuffer[0];
     GLint uniformSize;
     GLenum uniformType;
 
+    layout.program = program;
+    layout.uniforms.clear();
+    layout.uniforms.reserve(nbUniforms);
+    layout.blocks.clear();
+    layout.blockDataSize = 0;
+
+    std::vector<GLint> blockIndex;
+    std::vector<GLint> blockOffset;
+    std::vector<GLint> arrayStride;
+    if ((params.API == API_OPENGL && params.APIVersion >= 310) ||
+        (params.API == API_OPENGL_ES && params.APIVersion >= 300)) {
+        CHECK_STATUS(reflectUniformBlocks(layout, nbUniforms, blockIndex, blockOffset, arrayStride));
+    }
+
     for (int i = 0; i < nbUniforms; i++) {
         GL_SAFECALL(glGetActiveUniform, program, i, uniformNameMaxLength, NULL, &uniformSize, &uniformType, uniformName);
 
@@ -338,109 +893,256 @@ void setUniformsJSON(const GLuint& program, const Params& params) {
             *p = '\0';
         }
 
-        if (j.count(uniformName) == 0) {
-            crash("missing JSON entry for uniform: %s", uniformName);
+        // Ours, not the shader's: set for each tile, see addTileOffset()
+        if (strcmp(uniformName, "_GLF_tileOffset") == 0) {
+            continue;
+        }
+
+        // Block members have no location, only an offset in the block. A
+        // missing location is reported with the uniform set, after its entry.
+        ActiveUniform uniform;
+        uniform.name = uniformName;
+        uniform.location = -1;
+        uniform.blockIndex = blockIndex.empty() ? -1 : blockIndex[i];
+        uniform.offset = blockOffset.empty() ? 0 : blockOffset[i];
+        uniform.arrayStride = arrayStride.empty() ? 0 : arrayStride[i];
+        uniform.size = uniformSize;
+        if (uniform.blockIndex == -1) {
+            uniform.location = glGetUniformLocation(program, uniformName);
+            GL_CHECKERR("glGetUniformLocation");
         }
-        if (j.count(uniformName) > 1) {
-            crash("more than one JSON entry for uniform: %s", uniformName);
+        layout.uniforms.push_back(uniform);
+    }
+    return EXIT_SUCCESS;
+}
+
+/*---------------------------------------------------------------------------*/
+
+// Copy the values of a block member to the uniform buffer; arrays longer
+// than the member are truncated, as glUniform*v() does
+static void packBlockUniform(UniformPlan& plan, const UniformBinding& binding, const UniformBlock& block, GLint offset, GLint arrayStride, GLint uniformSize) {
+    size_t vectorSize = (size_t) binding.func->components * 4;
+    size_t stride = arrayStride > 0 ? (size_t) arrayStride : vectorSize;
+    GLsizei count = std::min(binding.count, (GLsizei) uniformSize);
+    const uint8_t *values = uniformValues(plan, binding);
+    uint8_t *out = &plan.blockData[block.offset + offset];
+    for (GLsizei k = 0; k < count; k++) {
+        memcpy(out + k * stride, values + k * vectorSize, vectorSize);
+    }
+}
+
+/*---------------------------------------------------------------------------*/
+
+// Only the values of the set are looked up, the layout is the program's
+
+static JobStatus buildUniformPlan(UniformPlan& plan, const UniformLayout& layout, const UniformSet& uniforms) {
+    plan.program = layout.program;
+    plan.bindings.clear();
+    plan.bindings.reserve(layout.uniforms.size());
+    plan.floats.clear();
+    plan.ints.clear();
+    plan.uints.clear();
+    plan.blocks = layout.blocks;
+    // Members without a JSON value are zero, like default block uniforms
+    plan.blockData.assign(layout.blockDataSize, 0);
+
+    for (std::vector<ActiveUniform>::const_iterator it = layout.uniforms.begin(); it != layout.uniforms.end(); ++it) {
+        const ActiveUniform& uniform = *it;
+        const char *uniformName = uniform.name.c_str();
+
+        UniformSet::const_iterator entry = uniforms.find(uniform.name);
+        if (entry == uniforms.end()) {
+            error_return("missing JSON entry for uniform: %s", uniformName);
         }
-        json uniformInfo = j[uniformName];
+        const UniformEntry& uniformInfo = entry->second;
 
         // Check presence of func and args entries
-        if (uniformInfo.find("func") == uniformInfo.end()) {
-            crash("malformed JSON: no 'func' entry for uniform: %s", uniformName);
+        if (!uniformInfo.hasFunc) {
+            error_return("malformed JSON: no 'func' entry for uniform: %s", uniformName);
         }
-        if (uniformInfo.find("args") == uniformInfo.end()) {
-            crash("malformed JSON: no 'args' entry for uniform: %s", uniformName);
+        if (!uniformInfo.hasArgs) {
+            error_return("malformed JSON: no 'args' entry for uniform: %s", uniformName);
         }
-
-        // Get uniform location
-        GLint uniformLocation = glGetUniformLocation(program, uniformName);
-        GL_CHECKERR("glGetUniformLocation");
-        if (uniformLocation == -1) {
-            crash("Cannot find uniform named: %s", uniformName);
+        if (!uniformInfo.funcIsString) {
+            error_return("malformed JSON: bad 'func' entry for uniform: %s", uniformName);
         }
+        const std::string& uniformFunc = uniformInfo.func;
+        const std::vector<double>& args = uniformInfo.args;
 
-        // Dispatch to matching init function
-        std::string uniformFunc = uniformInfo["func"];
-        json args = uniformInfo["args"];
+        UniformBinding binding;
+        binding.func = findUniformFunc(uniformFunc);
+        if (binding.func == NULL) {
+            error_return("unknown/unsupported uniform init func: %s", uniformFunc.c_str());
+        }
 
-        // TODO: check that args has the good number of fields and type
+        bool inBlock = uniform.blockIndex != -1;
+        binding.location = uniform.location;
+        if (!inBlock && binding.location == -1) {
+            error_return("Cannot find uniform named: %s", uniformName);
+        }
 
-        if (uniformFunc == "glUniform1f") {
-            glUniform1f(uniformLocation, args[0]);
-        } else if (uniformFunc == "glUniform2f") {
-            glUniform2f(uniformLocation, args[0], args[1]);
-        } else if (uniformFunc == "glUniform3f") {
-            glUniform3f(uniformLocation, args[0], args[1], args[2]);
-        } else if (uniformFunc == "glUniform4f") {
-            glUniform4f(uniformLocation, args[0], args[1], args[2], args[3]);
+        // The array setters take whole vectors, the others ignore extra values
+        size_t components = (size_t) binding.func->components;
+        size_t n = binding.func->array ? args.size() : components;
+        if (!uniformInfo.argsIsArray || args.size() < components || n % components != 0) {
+            error_return("malformed JSON: bad 'args' entry for uniform: %s (%d values expected)", uniformName, (int) components);
         }
+        if (uniformInfo.argsError != "" && uniformInfo.badArg < n) {
+            error_return("malformed JSON: bad 'args' entry for uniform: %s (%s)", uniformName, uniformInfo.argsError.c_str());
+        }
+        binding.count = (GLsizei) (n / components);
 
-        else if (uniformFunc == "glUniform1i") {
-            glUniform1i(uniformLocation, args[0]);
-        } else if (uniformFunc == "glUniform2i") {
-            glUniform2i(uniformLocation, args[0], args[1]);
-        } else if (uniformFunc == "glUniform3i") {
-            glUniform3i(uniformLocation, args[0], args[1], args[2]);
-        } else if (uniformFunc == "glUniform4i") {
-            glUniform4i(uniformLocation, args[0], args[1], args[2], args[3]);
+        addUniformArgs(plan, binding, args, n);
+        if (inBlock) {
+            packBlockUniform(plan, binding, plan.blocks[uniform.blockIndex], uniform.offset, uniform.arrayStride, uniform.size);
+            dropUniformArgs(plan, binding);
+        } else {
+            plan.bindings.push_back(binding);
         }
+    }
 
-        // Note: GLES does not provide glUniformXui primitives
-#ifndef GL_VERSION_ES_CM_1_0
+    return EXIT_SUCCESS;
+}
+
+/*---------------------------------------------------------------------------*/
+
+// Block i is bound to uniform buffer binding point i
 
-        else if (uniformFunc == "glUniform1ui") {
-          glUniform1ui(uniformLocation, args[0]);
-        } else if (uniformFunc == "glUniform2ui") {
-          glUniform2ui(uniformLocation, args[0], args[1]);
-        } else if (uniformFunc == "glUniform3ui") {
-          glUniform3ui(uniformLocation, args[0], args[1], args[2]);
-        } else if (uniformFunc == "glUniform4ui") {
-          glUniform4ui(uniformLocation, args[0], args[1], args[2], args[3]);
+static JobStatus applyUniformPlan(const UniformPlan& plan, Params& params) {
+    if (!plan.blocks.empty()) {
+        GLuint buffer = params.uniformBuffer;
+        if (buffer == 0) {
+            GL_SAFECALL(glGenBuffers, 1, &buffer);
+            params.uniformBuffer = buffer;
         }
+        GL_SAFECALL(glBindBuffer, GL_UNIFORM_BUFFER, buffer);
+        GL_SAFECALL(glBufferData, GL_UNIFORM_BUFFER, plan.blockData.size(), plan.blockData.data(), GL_STATIC_DRAW);
+        for (std::vector<UniformBlock>::const_iterator it = plan.blocks.begin(); it != plan.blocks.end(); ++it) {
+            GL_SAFECALL(glBindBufferRange, GL_UNIFORM_BUFFER, it->index, buffer, it->offset, it->size);
+            GL_SAFECALL(glUniformBlockBinding, plan.program, it->index, it->index);
+        }
+    }
 
+    for (std::vector<UniformBinding>::const_iterator it = plan.bindings.begin(); it != plan.bindings.end(); ++it) {
+        const UniformBinding& b = *it;
+        const GLfloat *f = plan.floats.data() + b.offset;
+        const GLint *n = plan.ints.data() + b.offset;
+        const GLuint *u = plan.uints.data() + b.offset;
+        (void) u;
+
+        switch (b.func->op) {
+        case UNIFORM_1F: glUniform1f(b.location, f[0]); break;
+        case UNIFORM_2F: glUniform2f(b.location, f[0], f[1]); break;
+        case UNIFORM_3F: glUniform3f(b.location, f[0], f[1], f[2]); break;
+        case UNIFORM_4F: glUniform4f(b.location, f[0], f[1], f[2], f[3]); break;
+
+        case UNIFORM_1I: glUniform1i(b.location, n[0]); break;
+        case UNIFORM_2I: glUniform2i(b.location, n[0], n[1]); break;
+        case UNIFORM_3I: glUniform3i(b.location, n[0], n[1], n[2]); break;
+        case UNIFORM_4I: glUniform4i(b.location, n[0], n[1], n[2], n[3]); break;
+
+#ifndef GL_VERSION_ES_CM_1_0
+        case UNIFORM_1UI: glUniform1ui(b.location, u[0]); break;
+        case UNIFORM_2UI: glUniform2ui(b.location, u[0], u[1]); break;
+        case UNIFORM_3UI: glUniform3ui(b.location, u[0], u[1], u[2]); break;
+        case UNIFORM_4UI: glUniform4ui(b.location, u[0], u[1], u[2], u[3]); break;
+#else
+        case UNIFORM_1UI: case UNIFORM_2UI: case UNIFORM_3UI: case UNIFORM_4UI:
+            crash("glUniformXui is not available");
 #endif // ifndef GL_VERSION_ES_CM_1_0
 
-        else if (uniformFunc == "glUniform1fv") {
-            GLUNIFORM_ARRAYINIT(glUniform1fv, uniformLocation, GLfloat, args);
-        } else if (uniformFunc == "glUniform2fv") {
-            GLUNIFORM_ARRAYINIT(glUniform2fv, uniformLocation, GLfloat, args);
-        } else if (uniformFunc == "glUniform3fv") {
-            GLUNIFORM_ARRAYINIT(glUniform3fv, uniformLocation, GLfloat, args);
-        } else if (uniformFunc == "glUniform4fv") {
-            GLUNIFORM_ARRAYINIT(glUniform4fv, uniformLocation, GLfloat, args);
-        }
+        case UNIFORM_1FV: glUniform1fv(b.location, b.count, f); break;
+        case UNIFORM_2FV: glUniform2fv(b.location, b.count, f); break;
+        case UNIFORM_3FV: glUniform3fv(b.location, b.count, f); break;
+        case UNIFORM_4FV: glUniform4fv(b.location, b.count, f); break;
 
-        else if (uniformFunc == "glUniform1iv") {
-            GLUNIFORM_ARRAYINIT(glUniform1iv, uniformLocation, GLint, args);
-        } else if (uniformFunc == "glUniform2iv") {
-            GLUNIFORM_ARRAYINIT(glUniform2iv, uniformLocation, GLint, args);
-        } else if (uniformFunc == "glUniform3iv") {
-            GLUNIFORM_ARRAYINIT(glUniform3iv, uniformLocation, GLint, args);
-        } else if (uniformFunc == "glUniform4iv") {
-            GLUNIFORM_ARRAYINIT(glUniform4iv, uniformLocation, GLint, args);
+        case UNIFORM_1IV: glUniform1iv(b.location, b.count, n); break;
+        case UNIFORM_2IV: glUniform2iv(b.location, b.count, n); break;
+        case UNIFORM_3IV: glUniform3iv(b.location, b.count, n); break;
+        case UNIFORM_4IV: glUniform4iv(b.location, b.count, n); break;
         }
+        GL_CHECKERR(b.func->name);
+    }
+    return EXIT_SUCCESS;
+}
 
-        else {
-            crash("unknown/unsupported uniform init func: %s", uniformFunc.c_str());
-        }
-        GL_CHECKERR(uniformFunc.c_str());
+/*---------------------------------------------------------------------------*/
+
+// The JSON file, shared by the jobs using the same one, or if and only if
+// there is none, the defaults
+
+static JobStatus loadUniformSet(const Params& params, std::shared_ptr<const UniformSet>& uniforms) {
+    std::string jsonFilename = getJSONFilename(params);
+    if (isFile(jsonFilename)) {
+        BenchTimer timer(STAGE_JSON_PARSE);
+        return uniformFileLoad(jsonFilename, uniforms);
+    }
+    std::shared_ptr<UniformSet> defaults = std::make_shared<UniformSet>();
+    setUniformDefaults(*defaults, params);
+    uniforms = defaults;
+    return EXIT_SUCCESS;
+}
+
+static JobStatus applyUniformSet(const GLuint& program, Params& params, const UniformSet& uniforms) {
+    BenchTimer timer(STAGE_UNIFORMS);
+    UniformLayout layout;
+    UniformPlan plan;
+    CHECK_STATUS(reflectUniforms(layout, program, params));
+    CHECK_STATUS(buildUniformPlan(plan, layout, uniforms));
+    return applyUniformPlan(plan, params);
+}
+
+JobStatus setUniformsJSON(const GLuint& program, Params& params) {
+    TraceSpan span("setUniformsJSON");
+    GLint nbUniforms;
+    GL_SAFECALL(glGetProgramiv, program, GL_ACTIVE_UNIFORMS, &nbUniforms);
+    if (nbUniforms == 0) {
+        // If there are no uniforms to set, return now
+        return EXIT_SUCCESS;
     }
 
-    delete [] uniformName;
+    std::string jsonFilename = getJSONFilename(params);
+    if (!isFile(jsonFilename)) {
+        std::cerr << "Warning: file '" << jsonFilename << "' not found, will rely on default uniform values only" << std::endl;
+    }
+    std::shared_ptr<const UniformSet> uniforms;
+    CHECK_STATUS(loadUniformSet(params, uniforms));
+    return applyUniformSet(program, params, *uniforms);
 }
 
 /*---------------------------------------------------------------------------*/
 
-void setUniformTime(const Params& params) {
+// Frames only update the time uniform, whose location is looked up once
+
+static bool isAnimated(const Params& params) {
+    return params.animate || params.sequenceFrames > 0;
+}
+
+static JobStatus findUniformTime(Params& params) {
+    params.timeLocation = -1;
+    if (!isAnimated(params)) {
+        return EXIT_SUCCESS;
+    }
     GLint uniformLocation = glGetUniformLocation(params.program, params.timeVarName.c_str());
     GL_CHECKERR("glGetUniformLocation");
     if (uniformLocation == -1) {
-        crash("Cannot find uniform named: %s", params.timeVarName.c_str());
+        error_return("Cannot find uniform named: %s", params.timeVarName.c_str());
+    }
+    params.timeLocation = uniformLocation;
+    return EXIT_SUCCESS;
+}
+
+// Sequences have a deterministic time, --animate follows the CPU clock
+
+JobStatus setUniformTime(const Params& params) {
+    GLfloat timeVal;
+    if (params.sequenceFrames > 0) {
+        timeVal = (GLfloat) params.frameTime;
+    } else {
+        timeVal = (GLfloat) (std::clock() / (float) CLOCKS_PER_SEC * 50.0);
     }
-    GLfloat timeVal = (GLfloat) (std::clock() / (float) CLOCKS_PER_SEC * 50.0);
-    GL_SAFECALL(glUniform1f, uniformLocation, timeVal);
+    GL_SAFECALL(glUniform1f, params.timeLocation, timeVal);
+    return EXIT_SUCCESS;
 }
 
 
@@ -462,7 +1164,7 @@ const char *openglErrorString(GLenum err) {
 
 /*---------------------------------------------------------------------------*/
 
-void dumpBin(const Params& params, GLuint program) {
+JobStatus dumpBin(const Params& params, GLuint program) {
     int supported = ((params.API == API_OPENGL && params.APIVersion >= 410) ||
                      (params.API == API_OPENGL_ES && params.APIVersion >= 300));
     if (! supported) {
@@ -471,109 +1173,197 @@ void dumpBin(const Params& params, GLuint program) {
                " current version is: ");
         printAPI(params);
         printf("\n");
-        return;
+        return EXIT_SUCCESS;
     }
 
     GLint numFormats;
     GL_SAFECALL(glGetIntegerv, GL_NUM_PROGRAM_BINARY_FORMATS, &numFormats);
     if (numFormats <= 0) {
         printf("Cannot dump binary: driver supports zero binary format\n");
-        return;
+        return EXIT_SUCCESS;
     }
 
     GLint length;
     GL_SAFECALL(glGetProgramiv, program, GL_PROGRAM_BINARY_LENGTH, &length);
-    char *binary = (char *) malloc(length);
-    if (binary == NULL) {
-        crash("malloc failed");
-    }
+    std::vector<char> binary((size_t) length);
     GLenum format;
-    GL_SAFECALL(glGetProgramBinary, program, length, NULL, &format, (void *)binary);
-    std::ofstream binaryfile(params.binOut);
-    binaryfile.write(binary, length);
+    GL_SAFECALL(glGetProgramBinary, program, length, NULL, &format, (void *) binary.data());
+    std::ofstream binaryfile(params.binOut, std::ios::binary);
+    binaryfile.write(binary.data(), length);
     binaryfile.close();
+    if (!binaryfile) {
+        error_return("Cannot write binary to: %s", params.binOut.c_str());
+    }
+    return EXIT_SUCCESS;
 }
 
 /*---------------------------------------------------------------------------*/
 
-void printShaderError(GLuint shader) {
+static std::string shaderInfoLog(GLuint shader) {
     GLint length = 0;
     glGetShaderiv(shader, GL_INFO_LOG_LENGTH, &length);
+    if (length <= 0) {
+        return "";
+    }
     // The length includes the NULL character
     std::vector<GLchar> errorLog((size_t) length, 0);
     glGetShaderInfoLog(shader, length, &length, &errorLog[0]);
-    if(length > 0) {
-        std::string s(&errorLog[0]);
-        std::cout << s << std::endl;
-    }
+    return std::string(&errorLog[0]);
 }
 
 /*---------------------------------------------------------------------------*/
 
-void printProgramError(GLuint program) {
+static std::string programInfoLog(GLuint program) {
     GLint length = 0;
     glGetProgramiv(program, GL_INFO_LOG_LENGTH, &length);
+    if (length <= 0) {
+        return "";
+    }
     // The length includes the NULL character
     std::vector<GLchar> errorLog((size_t) length, 0);
     glGetProgramInfoLog(program, length, &length, &errorLog[0]);
-    if(length > 0) {
-        std::string s(&errorLog[0]);
-        std::cout << s << std::endl;
-    }
+    return std::string(&errorLog[0]);
 }
 
 /*---------------------------------------------------------------------------*/
 
-void openglInit(Params& params, const std::string& fragContents) {
-    const char *temp;
-    steady_clock::time_point timeStart;
-    GLint status = 0;
+// Logs are printed on failure only, but go to the job record in any case
 
-    GLuint vertexShader = glCreateShader(GL_VERTEX_SHADER);
-    GL_CHECKERR("glCreateShader");
-    std::string vertContents;
-    generateVertexShader(vertContents, params);
-    temp = vertContents.c_str();
-    GL_SAFECALL(glShaderSource, vertexShader, 1, &temp, NULL);
-    if (params.profile) {
-        GL_SAFECALL(glFinish);
-        timeStart = steady_clock::now();
+static void addInfoLog(Params& params, const std::string& log, bool failed) {
+    if (log == "") {
+        return;
     }
-    GL_SAFECALL(glCompileShader, vertexShader);
-    if (params.profile) {
-        GL_SAFECALL(glFinish);
-        printf("vertex shader compile time (us): %ld\n", duration_cast<microseconds>(steady_clock::now() - timeStart).count());
+    if (failed) {
+        std::cout << log << std::endl;
     }
-    GL_SAFECALL(glGetShaderiv, vertexShader, GL_COMPILE_STATUS, &status);
-    if (!status) {
-        printShaderError(vertexShader);
-        errcode_crash(COMPILE_ERROR_EXIT_CODE, "Vertex shader compilation failed (%s)", params.fragFilename.c_str());
+    params.infoLog += log;
+    if (log[log.size() - 1] != '\n') {
+        params.infoLog += '\n';
     }
+}
 
-    GLuint fragmentShader = glCreateShader(GL_FRAGMENT_SHADER);
-    GL_CHECKERR("glCreateShader");
-    temp = fragContents.c_str();
-    GL_SAFECALL(glShaderSource, fragmentShader, 1, &temp, NULL);
-    if (params.profile) {
-        GL_SAFECALL(glFinish);
-        timeStart = steady_clock::now();
+/*---------------------------------------------------------------------------*/
+
+// Jobs on the same context share their vertex shader, compiled once per
+// GLSL version and profile, or per --vertex file contents, and their
+// geometry: a single triangle that covers the viewport. A thread has one
+// context at a time, so these are thread local, and released by
+// openglReleaseShared() before the context goes.
+
+typedef struct {
+    std::shared_ptr<FileContents> source;
+    GLuint shader;          // 0 until compiled
+} SharedVertexShader;
+
+typedef struct {
+    std::map<std::string, SharedVertexShader> vertexShaders;
+    GLuint vertexArray;
+    GLuint vertexBuffer;
+    bool attribEnabled;     // Whether attribLocation reads from vertexBuffer
+    GLuint attribLocation;
+} SharedObjects;
+
+static thread_local SharedObjects shared;
+
+// Programs bind _GLF_vertexPosition here, so that the attribute setup of
+// the shared vertex array holds for all of them
+#define VERTEX_POSITION_LOCATION (0)
+
+/*---------------------------------------------------------------------------*/
+
+// The vertex shader of params, with its source generated or loaded, but
+// not compiled, on a miss
+
+static JobStatus findVertexShader(const Params& params, SharedVertexShader*& vertex) {
+    std::shared_ptr<FileContents> source;
+    std::string key;
+    if (params.vertFilename != "") {
+        source = std::make_shared<FileContents>();
+        CHECK_STATUS(source->load(params.vertFilename));
+        key = "file " + hashToString(hash64(source->data(), source->size()));
+    } else {
+        key = std::to_string(params.shaderVersion) + " " + std::to_string((int) params.shaderProfile);
     }
-    GL_SAFECALL(glCompileShader, fragmentShader);
-    if (params.profile) {
-        GL_SAFECALL(glFinish);
-        printf("fragment shader compile time (us): %ld\n", duration_cast<microseconds>(steady_clock::now() - timeStart).count());
+    SharedVertexShader& entry = shared.vertexShaders[key];
+    if (!entry.source) {
+        if (!source) {
+            source = std::make_shared<FileContents>();
+            CHECK_STATUS(generateVertexShader(*source, params));
+        }
+        entry.source = source;
+        entry.shader = 0;
     }
-    GL_SAFECALL(glGetShaderiv, fragmentShader, GL_COMPILE_STATUS, &status);
-    if (!status) {
-        printShaderError(fragmentShader);
-        errcode_crash(COMPILE_ERROR_EXIT_CODE, "Fragment shader compilation failed (%s)", params.fragFilename.c_str());
+    vertex = &entry;
+    return EXIT_SUCCESS;
+}
+
+/*---------------------------------------------------------------------------*/
+
+// The shared triangle, also for contexts without vertex arrays, whose
+// default attribute state lasts as well
+
+static JobStatus bindSharedGeometry(const Params& params, GLuint vertPosLoc) {
+    static const float vertices[] = {
+        -1.0f, -1.0f, 3.0f, -1.0f, -1.0f, 3.0f
+    };
+
+    if (shared.vertexArray == 0 && (params.API == API_OPENGL_ES || params.APIVersion >= 300)) {
+        GLuint vertexArray;
+        GL_SAFECALL(glGenVertexArrays, 1, &vertexArray);
+        shared.vertexArray = vertexArray;
     }
+    if (shared.vertexArray != 0) {
+        GL_SAFECALL(glBindVertexArray, shared.vertexArray);
+    }
+    if (shared.vertexBuffer == 0) {
+        GLuint vertexBuffer;
+        GL_SAFECALL(glGenBuffers, 1, &vertexBuffer);
+        shared.vertexBuffer = vertexBuffer;
+        GL_SAFECALL(glBindBuffer, GL_ARRAY_BUFFER, vertexBuffer);
+        GL_SAFECALL(glBufferData, GL_ARRAY_BUFFER, sizeof(vertices), vertices, GL_STATIC_DRAW);
+        shared.attribEnabled = false;
+    }
+    // Only programs from binaries cached before the binding differ
+    if (!shared.attribEnabled || shared.attribLocation != vertPosLoc) {
+        GL_SAFECALL(glBindBuffer, GL_ARRAY_BUFFER, shared.vertexBuffer);
+        GL_SAFECALL(glEnableVertexAttribArray, vertPosLoc);
+        GL_SAFECALL(glVertexAttribPointer, vertPosLoc, 2, GL_FLOAT, GL_FALSE, 0, 0);
+        shared.attribEnabled = true;
+        shared.attribLocation = vertPosLoc;
+    }
+    return EXIT_SUCCESS;
+}
 
-    if (params.exitCompile) {
-        exit(EXIT_SUCCESS);
+/*---------------------------------------------------------------------------*/
+
+// No error checking either, the context is about to go
+
+static void openglReleaseShared() {
+    std::map<std::string, SharedVertexShader>::iterator it;
+    for (it = shared.vertexShaders.begin(); it != shared.vertexShaders.end(); ++it) {
+        if (it->second.shader != 0) {
+            glDeleteShader(it->second.shader);
+        }
+    }
+    shared.vertexShaders.clear();
+    if (shared.vertexArray != 0) {
+        glBindVertexArray(0);
+        glDeleteVertexArrays(1, &shared.vertexArray);
+        shared.vertexArray = 0;
     }
+    if (shared.vertexBuffer != 0) {
+        glDeleteBuffers(1, &shared.vertexBuffer);
+        shared.vertexBuffer = 0;
+    }
+    shared.attribEnabled = false;
+    openglClearErrors();
+}
 
+/*---------------------------------------------------------------------------*/
+
+static JobStatus createProgram(Params& params) {
     GLuint program = glCreateProgram();
+    params.program = program;
     int supported = ((params.API == API_OPENGL && params.APIVersion >= 410) ||
                      (params.API == API_OPENGL_ES && params.APIVersion >= 300));
     if (supported) {
@@ -581,150 +1371,1983 @@ void openglInit(Params& params, const std::string& fragContents) {
     }
     GL_CHECKERR("glCreateProgram");
     if (program == 0) {
-        crash("glCreateProgram()");
+        error_return("glCreateProgram()");
     }
-    GL_SAFECALL(glAttachShader, program, vertexShader);
-    GL_SAFECALL(glAttachShader, program, fragmentShader);
-    if (params.profile) {
-        GL_SAFECALL(glFinish);
-        timeStart = steady_clock::now();
+    GL_SAFECALL(glAttachShader, program, params.vertexShader);
+    GL_SAFECALL(glAttachShader, program, params.fragmentShader);
+    GL_SAFECALL(glBindAttribLocation, program, VERTEX_POSITION_LOCATION, "_GLF_vertexPosition");
+    return EXIT_SUCCESS;
+}
+
+/*---------------------------------------------------------------------------*/
+
+static JobStatus checkCompile(Params& params, GLuint shader, const char *shaderKind) {
+    GLint status = 0;
+    GL_SAFECALL(glGetShaderiv, shader, GL_COMPILE_STATUS, &status);
+    if (!status || params.metricsFd >= 0) {
+        addInfoLog(params, shaderInfoLog(shader), !status);
     }
-    GL_SAFECALL(glLinkProgram, program);
-    if (params.profile) {
-        GL_SAFECALL(glFinish);
-        printf("link time (us): %ld\n", duration_cast<microseconds>(steady_clock::now() - timeStart).count());
+    if (!status) {
+        errcode_return(COMPILE_ERROR_EXIT_CODE, "%s shader compilation failed (%s)", shaderKind, params.fragFilename.c_str());
+    }
+    return EXIT_SUCCESS;
+}
+
+/*---------------------------------------------------------------------------*/
+
+static JobStatus checkLink(Params& params) {
+    GLint status = 0;
+    GL_SAFECALL(glGetProgramiv, params.program, GL_LINK_STATUS, &status);
+    if (!status || params.metricsFd >= 0) {
+        addInfoLog(params, programInfoLog(params.program), !status);
     }
-    GL_SAFECALL(glGetProgramiv, program, GL_LINK_STATUS, &status);
     if (!status) {
-        printProgramError(program);
-        errcode_crash(LINK_ERROR_EXIT_CODE, "Program linking failed");
+        errcode_return(LINK_ERROR_EXIT_CODE, "Program linking failed");
+    }
+
+    if (!params.programCached && params.programCacheKey != "") {
+        programCacheStore(params);
     }
 
     if(strcmp(params.binOut.c_str(), "")) {
-        dumpBin(params, program);
+        CHECK_STATUS(dumpBin(params, params.program));
     }
+    return EXIT_SUCCESS;
+}
 
-    if (params.exitLinking) {
-        exit(EXIT_SUCCESS);
+/*---------------------------------------------------------------------------*/
+
+// On a program cache hit, params.program is already linked, and the
+// shaders are not even created.
+
+static bool loadCachedProgram(Params& params, const FileContents& vertContents, const FileContents& fragContents) {
+    if (params.programCache == "") {
+        return false;
     }
+    params.programCacheKey = programCacheKey(params, vertContents, fragContents);
+    if (params.programCacheKey == "") {
+        return false;
+    }
+    return programCacheLoad(params);
+}
+
+/*---------------------------------------------------------------------------*/
+
+// Everything after linking: geometry, uniforms and viewport.
+
+static JobStatus setupProgram(Params& params) {
+    GLuint program = params.program;
 
     GLint vertPosLocInt = glGetAttribLocation(program, "_GLF_vertexPosition");
     GL_CHECKERR("glGetAttribLocation");
     if (vertPosLocInt == -1) {
-        crash("Cannot find position of _GLF_vertexPosition");
+        error_return("Cannot find position of _GLF_vertexPosition");
     }
-    GLuint vertPosLoc = (GLuint) vertPosLocInt;
-
-    const float vertices[] = {
-        -1.0f, -1.0f, -1.0f, 1.0f, 1.0f, -1.0f,
-         1.0f,  1.0f, -1.0f, 1.0f, 1.0f, -1.0f
-    };
+    CHECK_STATUS(bindSharedGeometry(params, (GLuint) vertPosLocInt));
 
-    GLuint vertexBuffer;
-    if (params.API == API_OPENGL_ES || params.APIVersion >= 300) {
-        GLuint vertexArray;
-        GL_SAFECALL(glGenVertexArrays, 1, &vertexArray);
-        GL_SAFECALL(glBindVertexArray, vertexArray);
+    GL_SAFECALL(glUseProgram, program);
+    // With variants, only the uniform sets merged with them are complete
+    if (params.variantsFilename == "") {
+        CHECK_STATUS(setUniformsJSON(program, params));
     }
-    GL_SAFECALL(glGenBuffers, 1, &vertexBuffer);
-    GL_SAFECALL(glBindBuffer, GL_ARRAY_BUFFER, vertexBuffer);
-    GL_SAFECALL(glBufferData, GL_ARRAY_BUFFER, sizeof(vertices), vertices, GL_STATIC_DRAW);
-    GL_SAFECALL(glEnableVertexAttribArray, vertPosLoc);
-    GL_SAFECALL(glVertexAttribPointer, vertPosLoc, 2, GL_FLOAT, GL_FALSE, 0, 0);
-
-    GL_SAFECALL(glUseProgram, program);
-    setUniformsJSON(program, params);
+    CHECK_STATUS(findUniformTime(params));
 
     GL_SAFECALL(glViewport, 0, 0, params.width, params.height);
-    params.program = program;
+    GL_CHECKSTAGE("program setup");
+    return EXIT_SUCCESS;
+}
+
+/*---------------------------------------------------------------------------*/
+
+JobStatus openglFinishInit(Params& params);
+
+// The GL objects created here are recorded in params, so that
+// openglTerminate() can release them whatever the outcome.
+
+// Sources are passed with their length, so they need no null terminator
+
+static JobStatus shaderSource(GLuint shader, const FileContents& contents) {
+    const char *source = contents.data();
+    GLint length = (GLint) contents.size();
+    GL_SAFECALL(glShaderSource, shader, 1, &source, &length);
+    return EXIT_SUCCESS;
+}
+
+/*---------------------------------------------------------------------------*/
+
+// Besides the --profile times, the CPU time of the compilations and of the
+// link, status queries included, is always kept: these block until the
+// driver is done, without the glFinish() calls.
+
+JobStatus openglInit(Params& params, const FileContents& fragContents) {
+    steady_clock::time_point timeStart;
+    steady_clock::time_point cpuStart;
+
+    SharedVertexShader *vertex;
+    CHECK_STATUS(findVertexShader(params, vertex));
+    if (loadCachedProgram(params, *vertex->source, fragContents)) {
+        return openglFinishInit(params);
+    }
+
+    // Only the first job of the context with this vertex shader compiles
+    // it, and has its time
+    steady_clock::duration compileTime = steady_clock::duration::zero();
+    if (vertex->shader == 0) {
+        GLuint vertexShader = glCreateShader(GL_VERTEX_SHADER);
+        GL_CHECKERR("glCreateShader");
+        vertex->shader = vertexShader;
+        CHECK_STATUS(shaderSource(vertexShader, *vertex->source));
+        // Spans include the status query, which waits for the driver
+        TraceSpan vertexSpan("glCompileShader vertex");
+        cpuStart = steady_clock::now();
+        if (params.profile) {
+            GL_SAFECALL(glFinish);
+            timeStart = steady_clock::now();
+        }
+        GL_SAFECALL(glCompileShader, vertexShader);
+        if (params.profile) {
+            GL_SAFECALL(glFinish);
+            printf("vertex shader compile time (us): %ld\n", duration_cast<microseconds>(steady_clock::now() - timeStart).count());
+        }
+        CHECK_STATUS(checkCompile(params, vertexShader, "Vertex"));
+        compileTime = steady_clock::now() - cpuStart;
+    } else {
+        // A failure is the same for each job
+        CHECK_STATUS(checkCompile(params, vertex->shader, "Vertex"));
+    }
+    params.vertexShader = vertex->shader;
+
+    GLuint fragmentShader = glCreateShader(GL_FRAGMENT_SHADER);
+    GL_CHECKERR("glCreateShader");
+    params.fragmentShader = fragmentShader;
+    CHECK_STATUS(shaderSource(fragmentShader, fragContents));
+    TraceSpan fragmentSpan("glCompileShader fragment");
+    cpuStart = steady_clock::now();
+    if (params.profile) {
+        GL_SAFECALL(glFinish);
+        timeStart = steady_clock::now();
+    }
+    GL_SAFECALL(glCompileShader, fragmentShader);
+    if (params.profile) {
+        GL_SAFECALL(glFinish);
+        printf("fragment shader compile time (us): %ld\n", duration_cast<microseconds>(steady_clock::now() - timeStart).count());
+    }
+    CHECK_STATUS(checkCompile(params, fragmentShader, "Fragment"));
+    compileTime += steady_clock::now() - cpuStart;
+    fragmentSpan.end();
+    params.compileTime = duration_cast<microseconds>(compileTime).count();
+    benchRecord(STAGE_COMPILE, compileTime);
+
+    if (params.exitCompile) {
+        return EXIT_SUCCESS;
+    }
+
+    CHECK_STATUS(createProgram(params));
+    TraceSpan linkSpan("glLinkProgram");
+    cpuStart = steady_clock::now();
+    if (params.profile) {
+        GL_SAFECALL(glFinish);
+        timeStart = steady_clock::now();
+    }
+    GL_SAFECALL(glLinkProgram, params.program);
+    if (params.profile) {
+        GL_SAFECALL(glFinish);
+        printf("link time (us): %ld\n", duration_cast<microseconds>(steady_clock::now() - timeStart).count());
+    }
+    CHECK_STATUS(checkLink(params));
+    steady_clock::duration linkTime = steady_clock::now() - cpuStart;
+    linkSpan.end();
+    params.linkTime = duration_cast<microseconds>(linkTime).count();
+    benchRecord(STAGE_LINK, linkTime);
+
+    if (params.exitLinking) {
+        return EXIT_SUCCESS;
+    }
+
+    return setupProgram(params);
+}
+
+/*---------------------------------------------------------------------------*/
+
+// Split version of openglInit() for GL_KHR_parallel_shader_compile: submit
+// the compilation and linking without querying their status, which would
+// block until the driver is done. Once openglProgramReady() says so,
+// openglFinishInit() reports errors and does the rest of the setup.
+
+JobStatus openglSubmitProgram(Params& params, const FileContents& fragContents) {
+    SharedVertexShader *vertex;
+    CHECK_STATUS(findVertexShader(params, vertex));
+    if (loadCachedProgram(params, *vertex->source, fragContents)) {
+        return EXIT_SUCCESS;
+    }
+
+    if (vertex->shader == 0) {
+        GLuint vertexShader = glCreateShader(GL_VERTEX_SHADER);
+        GL_CHECKERR("glCreateShader");
+        vertex->shader = vertexShader;
+        CHECK_STATUS(shaderSource(vertexShader, *vertex->source));
+        TraceSpan vertexSpan("glCompileShader vertex");
+        GL_SAFECALL(glCompileShader, vertexShader);
+    }
+    params.vertexShader = vertex->shader;
+
+    params.fragmentShader = glCreateShader(GL_FRAGMENT_SHADER);
+    GL_CHECKERR("glCreateShader");
+    CHECK_STATUS(shaderSource(params.fragmentShader, fragContents));
+    TraceSpan fragmentSpan("glCompileShader fragment");
+    GL_SAFECALL(glCompileShader, params.fragmentShader);
+    fragmentSpan.end();
+
+    if (params.exitCompile) {
+        return EXIT_SUCCESS;
+    }
+
+    CHECK_STATUS(createProgram(params));
+    TraceSpan linkSpan("glLinkProgram");
+    GL_SAFECALL(glLinkProgram, params.program);
+    GL_CHECKSTAGE("program submission");
+    return EXIT_SUCCESS;
+}
+
+/*---------------------------------------------------------------------------*/
+
+bool openglProgramReady(const Params& params) {
+    GLint done = GL_TRUE;
+    if (params.program != 0) {
+        glGetProgramiv(params.program, GL_COMPLETION_STATUS_KHR, &done);
+    } else {
+        glGetShaderiv(params.fragmentShader, GL_COMPLETION_STATUS_KHR, &done);
+    }
+    return done == GL_TRUE;
+}
+
+/*---------------------------------------------------------------------------*/
+
+JobStatus openglFinishInit(Params& params) {
+    // Waits for the background compilation, if not done yet
+    TraceSpan span("openglFinishInit");
+    if (!params.programCached) {
+        CHECK_STATUS(checkCompile(params, params.vertexShader, "Vertex"));
+        CHECK_STATUS(checkCompile(params, params.fragmentShader, "Fragment"));
+    }
+    if (params.exitCompile) {
+        return EXIT_SUCCESS;
+    }
+
+    CHECK_STATUS(checkLink(params));
+    if (params.exitLinking) {
+        return EXIT_SUCCESS;
+    }
+
+    return setupProgram(params);
+}
+
+/*---------------------------------------------------------------------------*/
+
+// Release the GL objects created by openglInit(), so that the context can
+// be reused for another shader. This runs after failures too, hence no
+// error checking here: pending errors are cleared instead, so they do not
+// get blamed on the next job.
+
+void openglTerminate(Params& params) {
+    glUseProgram(0);
+    if (params.uniformBuffer != 0) {
+        glDeleteBuffers(1, &params.uniformBuffer);
+        params.uniformBuffer = 0;
+    }
+    if (params.program != 0) {
+        glDeleteProgram(params.program);
+        params.program = 0;
+    }
+    // Left to openglReleaseShared()
+    params.vertexShader = 0;
+    if (params.fragmentShader != 0) {
+        glDeleteShader(params.fragmentShader);
+        params.fragmentShader = 0;
+    }
+
+    params.programCacheKey = "";
+    params.programCached = false;
+
+    openglClearErrors();
 }
 
 /*---------------------------------------------------------------------------*/
 
-void openglRender(const Params& params) {
+// The draws of a frame, on their own so that --gpu-time times just these
+
+static JobStatus openglDraw(const Params& params) {
+    GL_SAFECALL(glDrawArrays, GL_TRIANGLES, 0, 3);
+    return EXIT_SUCCESS;
+}
+
+JobStatus openglRender(const Params& params) {
+    TraceSpan span("openglRender");
     steady_clock::time_point timeStart;
-    if (params.animate) {
-        setUniformTime(params);
+    if (isAnimated(params)) {
+        CHECK_STATUS(setUniformTime(params));
     }
     GL_SAFECALL(glClearColor, 0.0f, 0.0f, 0.0f, 1.0f);
     GL_SAFECALL(glClear, GL_COLOR_BUFFER_BIT);
-//    GL_SAFECALL(glDrawElements, GL_TRIANGLES, 6, GL_UNSIGNED_BYTE, 0);
     if (params.profile) {
         GL_SAFECALL(glFinish);
         timeStart = steady_clock::now();
     }
-    GL_SAFECALL(glDrawArrays, GL_TRIANGLES, 0, 3);
-    GL_SAFECALL(glDrawArrays, GL_TRIANGLES, 3, 3);
+    CHECK_STATUS(openglDraw(params));
     if (params.profile) {
         GL_SAFECALL(glFinish);
         printf("render time (us): %ld\n", duration_cast<microseconds>(steady_clock::now() - timeStart).count());
     }
     GL_SAFECALL(glFlush);
+    return EXIT_SUCCESS;
+}
+
+// Frames drawn before capture: a shader that does not animate gives the
+// same image every time, so only drivers needing warm-up frames should
+// ask for more with --delay.
+
+#define DEFAULT_ANIMATED_DELAY (5)
+
+static int frameCount(const Params& params) {
+    if (params.delay > 0) {
+        return params.delay;
+    }
+    return params.animate ? DEFAULT_ANIMATED_DELAY : 1;
+}
+
+/*---------------------------------------------------------------------------*/
+// Offscreen framebuffer
+/*---------------------------------------------------------------------------*/
+
+static void initFramebuffer(const Params& params, Context& context) {
+    if (params.fboFormat == FBO_NONE) {
+        return;
+    }
+    if (framebufferInit(context.framebuffer, params) != EXIT_SUCCESS) {
+        crash("Cannot render offscreen");
+    }
+}
+
+static void terminateFramebuffer(const Params& params, Context& context) {
+    if (params.fboFormat != FBO_NONE) {
+        framebufferTerminate(context.framebuffer);
+    }
+}
+
+/*---------------------------------------------------------------------------*/
+
+static bool isTiled(const Params& params, const Context& context) {
+    return params.fboFormat != FBO_NONE && framebufferTiled(context.framebuffer, params);
+}
+
+// Atlas tiles are offset like tiles of a larger image
+
+static bool needsTileOffset(const Params& params, const Context& context) {
+    return isTiled(params, context) || (params.atlas && params.variantsFilename != "");
+}
+
+/*---------------------------------------------------------------------------*/
+
+// Length of the comment at i, if any. As in memoNormalize(), block comments
+// may span lines.
+
+static size_t commentLength(const std::string& source, size_t i) {
+    if (source.compare(i, 2, "//") == 0) {
+        size_t end = source.find('\n', i);
+        return (end == std::string::npos ? source.size() : end) - i;
+    }
+    if (source.compare(i, 2, "/*") == 0) {
+        size_t end = source.find("*/", i + 2);
+        return (end == std::string::npos ? source.size() : end + 2) - i;
+    }
+    return 0;
+}
+
+// Where declarations can go: after the #version and #extension
+// directives, which may only be preceded by comments and blank lines
+
+static size_t afterDirectives(const std::string& source) {
+    size_t insert = 0;
+    size_t i = 0;
+    while (i < source.size()) {
+        size_t comment = commentLength(source, i);
+        if (comment > 0) {
+            i += comment;
+        } else if (source[i] == ' ' || source[i] == '\t' || source[i] == '\r' || source[i] == '\n') {
+            i++;
+        } else if (source.compare(i, 8, "#version") == 0 || source.compare(i, 10, "#extension") == 0) {
+            // To the end of the line, past the comments that run over it
+            while (i < source.size() && source[i] != '\n') {
+                comment = commentLength(source, i);
+                i += comment > 0 ? comment : 1;
+            }
+            insert = std::min(i + 1, source.size());
+            i = insert;
+        } else {
+            break;
+        }
+    }
+    return insert;
+}
+
+// Tiles are drawn at the origin of the framebuffer. For the shader to see
+// the position of its fragments in the whole image, gl_FragCoord is
+// replaced by a macro that adds the offset of the tile, given by the
+// _GLF_tileOffset uniform.
+
+static void addTileOffset(FileContents& contents) {
+    static const std::string builtin = "gl_FragCoord";
+    const std::string fragContents = contents.str();
+    std::string out;
+    size_t pos = 0;
+    size_t found;
+    while ((found = fragContents.find(builtin, pos)) != std::string::npos) {
+        size_t end = found + builtin.size();
+        bool token = (found == 0 || !isIdentifierChar(fragContents[found - 1])) &&
+                     (end == fragContents.size() || !isIdentifierChar(fragContents[end]));
+        out.append(fragContents, pos, found - pos);
+        out += token ? "_GLF_FragCoord" : builtin;
+        pos = end;
+    }
+    out.append(fragContents, pos, std::string::npos);
+
+    size_t insert = afterDirectives(out);
+    static const std::string declarations =
+        "\n"
+        "#ifdef GL_ES\n"
+        "#ifdef GL_FRAGMENT_PRECISION_HIGH\n"
+        "uniform highp vec2 _GLF_tileOffset;\n"
+        "#else\n"
+        "uniform mediump vec2 _GLF_tileOffset;\n"
+        "#endif\n"
+        "#else\n"
+        "uniform vec2 _GLF_tileOffset;\n"
+        "#endif\n"
+        "#define _GLF_FragCoord (gl_FragCoord + vec4(_GLF_tileOffset, 0.0, 0.0))\n";
+    if (insert > 0 && out[insert - 1] != '\n') {
+        out.insert(insert++, "\n");
+    }
+    out.insert(insert, declarations);
+    contents.assign(std::move(out));
 }
 
 /*---------------------------------------------------------------------------*/
-// PNG
+
+// Make the framebuffer or surface of the context ready for an image of
+// params.width x params.height, or for its first tile.
+
+static JobStatus bindTarget(const Params& params, Context& context) {
+    if (params.fboFormat == FBO_NONE) {
+        contextResize(context, params.width, params.height);
+        return EXIT_SUCCESS;
+    }
+    Framebuffer& fb = context.framebuffer;
+    int width = std::min(params.width, fb.maxSize);
+    int height = std::min(params.height, fb.maxSize);
+    CHECK_STATUS(framebufferBind(fb, params, width, height));
+    GL_SAFECALL(glViewport, 0, 0, width, height);
+    return EXIT_SUCCESS;
+}
+
 /*---------------------------------------------------------------------------*/
 
-// 4 channels: RGBA
-#define CHANNELS (4)
+// Draw the image again tile by tile, reading each tile into its place
+
+static JobStatus renderTiles(const Params& params, Context& context, std::vector<std::uint8_t>& data) {
+    Framebuffer& fb = context.framebuffer;
+    GLint offsetLoc = glGetUniformLocation(params.program, "_GLF_tileOffset");
+    GL_CHECKERR("glGetUniformLocation");
+    for (int y = 0; y < params.height; y += fb.maxSize) {
+        for (int x = 0; x < params.width; x += fb.maxSize) {
+            int width = std::min(fb.maxSize, params.width - x);
+            int height = std::min(fb.maxSize, params.height - y);
+            // Not found when the shader does not use gl_FragCoord
+            if (offsetLoc != -1) {
+                GL_SAFECALL(glUniform2f, offsetLoc, (float) x, (float) y);
+            }
+            GL_SAFECALL(glViewport, 0, 0, width, height);
+            CHECK_STATUS(openglRender(params));
+            CHECK_STATUS(framebufferRead(params, x, y, width, height, data));
+        }
+    }
+    return EXIT_SUCCESS;
+}
 
+/*---------------------------------------------------------------------------*/
+// Image output
 /*---------------------------------------------------------------------------*/
 
-void savePNG(Params& params) {
+JobStatus readPixels(const Params& params, std::vector<std::uint8_t>& data) {
     unsigned int uwidth = (unsigned int) params.width;
     unsigned int uheight = (unsigned int) params.height;
-    std::vector<std::uint8_t> data(uwidth * uheight * CHANNELS);
+    data.resize(uwidth * uheight * CHANNELS);
+    TraceSpan span("glReadPixels");
     GL_SAFECALL(glReadPixels, 0, 0, uwidth, uheight, GL_RGBA, GL_UNSIGNED_BYTE, &data[0]);
-    std::vector<std::uint8_t> flipped_data(uwidth * uheight * CHANNELS);
-    for (unsigned int h = 0; h < uheight ; h++)
-        for (unsigned int col = 0; col < uwidth * CHANNELS; col++)
-            flipped_data[h * uwidth * CHANNELS + col] =
-                data[(uheight - h - 1) * uwidth * CHANNELS + col];
-    unsigned png_error = lodepng::encode(params.output, flipped_data, uwidth, uheight);
-    if (png_error) {
-        crash("lodepng: %s", lodepng_error_text(png_error));
+    return EXIT_SUCCESS;
+}
+
+/*---------------------------------------------------------------------------*/
+
+// Read the image of the context, whatever its render target
+
+static JobStatus readImage(const Params& params, Context& context, std::vector<std::uint8_t>& data) {
+    BenchTimer timer(STAGE_READBACK);
+    if (params.fboFormat == FBO_NONE) {
+        CHECK_STATUS(readPixels(params, data));
+    } else {
+        data.resize((size_t) params.width * params.height * CHANNELS);
+        if (isTiled(params, context)) {
+            CHECK_STATUS(renderTiles(params, context, data));
+        } else {
+            CHECK_STATUS(framebufferRead(params, 0, 0, params.width, params.height, data));
+        }
     }
+    GL_CHECKSTAGE("readback");
+    return EXIT_SUCCESS;
 }
 
 /*---------------------------------------------------------------------------*/
-// Main
+
+// Add the outcome of checkImage() to a JSON result line
+
+static void addCheckResult(json& result, const ImageCheck& check) {
+    if (check.hashed) {
+        result["hash"] = hashToString(check.hash);
+    }
+    if (check.compared) {
+        result["match"] = check.match;
+    }
+    if (check.pixelDiff) {
+        result["maxDelta"] = check.maxDelta;
+        result["diffPixels"] = check.diffPixels;
+    }
+}
+
+// Add the CPU compile and link times, and the GPU times if any, to a JSON
+// result line
+
+static void addTimeResult(json& result, const Params& params, const GpuTimes& times) {
+    if (params.compileTime >= 0) {
+        result["compile_time_us"] = params.compileTime;
+    }
+    if (params.linkTime >= 0) {
+        result["link_time_us"] = params.linkTime;
+    }
+    if (times.count > 0) {
+        json& gpu = result["gpu_time_us"];
+        gpu["draws"] = times.count;
+        gpu["min"] = times.min;
+        gpu["median"] = times.median;
+        gpu["p95"] = times.p95;
+        gpu["max"] = times.max;
+    }
+}
+
 /*---------------------------------------------------------------------------*/
 
-int main(int argc, char* argv[])
-{
-    std::string fragContents;
-    Context context;
-    Params params;
+// Time the draws of a job with --gpu-time, once its image is captured so
+// that the extra draws do not change it. Tiled images time the last tile.
 
-    setParams(params, argc, argv);
-    readFile(fragContents, params.fragFilename);
-    params.shaderVersion = getShaderVersion(fragContents);
-    contextInitAndGetAPI(params, context);
-    openglInit(params, fragContents);
+static JobStatus timeDraws(const Params& params, GpuTimes& times) {
+    times.count = 0;
+    if (params.gpuTimeRepeats < 1) {
+        return EXIT_SUCCESS;
+    }
+    return gpuTimeDraws(params, openglDraw, params.gpuTimeRepeats, times);
+}
 
-    int numFrames = 0;
-    bool saved = false;
+/*---------------------------------------------------------------------------*/
 
-    while (contextKeepLooping(context)) {
-        openglRender(params);
-        contextSwap(context);
-        numFrames++;
+JobStatus saveImage(Params& params, Context& context, ImageCheck& check) {
+    std::vector<std::uint8_t> data;
+    steady_clock::time_point timeStart = steady_clock::now();
+    CHECK_STATUS(readImage(params, context, data));
+    params.readbackTime = duration_cast<microseconds>(steady_clock::now() - timeStart).count();
+    timeStart = steady_clock::now();
+    JobStatus status = outputImage(params, data, check);
+    params.encodeTime = duration_cast<microseconds>(steady_clock::now() - timeStart).count();
+    if (check.hashed || check.compared) {
+        json result;
+        addCheckResult(result, check);
+        std::cout << result.dump() << std::endl;
+    }
+    return status;
+}
 
-        if (numFrames == params.delay && !saved) {
-            savePNG(params);
-            saved = true;
+/*---------------------------------------------------------------------------*/
 
-            if (params.persist) {
-                printf("Press any key to close the window...\n");
-                contextSetKeyCallback(context);
-            } else {
-                break;
+// Results of all batch workers go through here, one line each
+static std::mutex resultMutex;
+
+static void printResult(const json& result) {
+    std::lock_guard<std::mutex> lock(resultMutex);
+    std::cout << result.dump() << std::endl;
+}
+
+/*---------------------------------------------------------------------------*/
+// Frame sequences
+/*---------------------------------------------------------------------------*/
+
+// Index of a sequence frame or of a variant: its image is the index-th one
+// of the mmap file, or else goes to file_<index>.ext.
+
+static void setIndexedOutput(Params& frame, int index) {
+    if (frame.outputFormat == OUTPUT_MMAP) {
+        frame.outputOffset += index * outputRawSize(frame.width, frame.height);
+        return;
+    }
+    char suffix[16];
+    snprintf(suffix, sizeof(suffix), "_%05d", index);
+    size_t slash = frame.output.find_last_of("/\\");
+    size_t dot = frame.output.find_last_of('.');
+    if (dot == std::string::npos || (slash != std::string::npos && dot < slash)) {
+        dot = frame.output.size();
+    }
+    frame.output.insert(dot, suffix);
+}
+
+/*---------------------------------------------------------------------------*/
+
+// Kind is "frame" or "variant", the key of the index in the result line
+
+static JobStatus outputIndexed(const Params& frame, const char *kind, int index, std::vector<std::uint8_t>& data) {
+    ImageCheck check;
+    JobStatus status = outputImage(frame, data, check);
+    if (check.hashed || check.compared) {
+        json result;
+        result[kind] = index;
+        result["output"] = frame.output;
+        addCheckResult(result, check);
+        printResult(result);
+    }
+    return status;
+}
+
+/*---------------------------------------------------------------------------*/
+
+// Frames waiting in the readback ring, oldest first
+
+typedef struct {
+    Params params;
+    int index;
+    size_t slot;
+} SequenceFrame;
+
+static JobStatus finishFrame(ReadbackRing& ring, std::deque<SequenceFrame>& pending) {
+    SequenceFrame frame = pending.front();
+    pending.pop_front();
+    std::vector<std::uint8_t> data;
+    CHECK_STATUS(readbackFinish(ring, frame.slot, data));
+    return outputIndexed(frame.params, "frame", frame.index, data);
+}
+
+/*---------------------------------------------------------------------------*/
+
+// Draw frames 0 to params.sequenceFrames - 1, frame i with the time uniform
+// at timeStart + i * timeStep, and write every captureEvery-th one. Through
+// pixel buffers if possible, so that the next frames render while earlier
+// ones are read back.
+
+#define SEQUENCE_READBACK_SLOTS (3)
+
+static JobStatus renderSequence(Params& params, Context& context) {
+    ReadbackRing ring;
+    bool async = readbackSupported(params) && !isTiled(params, context);
+    size_t slots = params.asyncReadback > 0 ? (size_t) params.asyncReadback : SEQUENCE_READBACK_SLOTS;
+    if (async && readbackInit(ring, slots) != EXIT_SUCCESS) {
+        printf("Warning: reading frames back synchronously\n");
+        readbackTerminate(ring);
+        async = false;
+    }
+
+    JobStatus status = EXIT_SUCCESS;
+    std::deque<SequenceFrame> pending;
+    for (int i = 0; i < params.sequenceFrames && status == EXIT_SUCCESS; i++) {
+        params.frameTime = params.timeStart + i * params.timeStep;
+        status = openglRender(params);
+        params.framesDrawn++;
+        bool capture = status == EXIT_SUCCESS && i % params.captureEvery == 0;
+        if (capture && async) {
+            if (readbackFull(ring)) {
+                status = finishFrame(ring, pending);
+            }
+            SequenceFrame frame;
+            frame.params = params;
+            frame.index = i / params.captureEvery;
+            setIndexedOutput(frame.params, frame.index);
+            if (status == EXIT_SUCCESS) {
+                status = readbackStart(ring, params, frame.slot);
+            }
+            if (status == EXIT_SUCCESS) {
+                pending.push_back(frame);
+            }
+        } else if (capture) {
+            Params frame = params;
+            int index = i / params.captureEvery;
+            setIndexedOutput(frame, index);
+            std::vector<std::uint8_t> data;
+            status = readImage(frame, context, data);
+            if (status == EXIT_SUCCESS) {
+                status = outputIndexed(frame, "frame", index, data);
             }
         }
+        if (i + 1 < params.sequenceFrames) {
+            contextSwap(context);
+        }
     }
-    contextTerminate(context);
-    exit(EXIT_SUCCESS);
+
+    // Started readbacks are finished even after a failure, to free their
+    // fences
+    while (!pending.empty()) {
+        JobStatus frameStatus = finishFrame(ring, pending);
+        if (status == EXIT_SUCCESS) {
+            status = frameStatus;
+        }
+    }
+    readbackTerminate(ring);
+    return status;
+}
+
+/*---------------------------------------------------------------------------*/
+// Batch mode
+/*---------------------------------------------------------------------------*/
+
+static bool hasOutput(const Params& params) {
+    return !params.exitCompile && !params.exitLinking;
+}
+
+/*---------------------------------------------------------------------------*/
+
+// Render the frames of a job, leaving its image in the framebuffer
+
+static JobStatus renderFrames(Params& params, Context& context) {
+    if (!hasOutput(params)) {
+        return EXIT_SUCCESS;
+    }
+    CHECK_STATUS(bindTarget(params, context));
+
+    // The image is read from the back buffer, so there is no swap after
+    // the last frame, hence none at all for a single one
+    steady_clock::time_point timeStart = steady_clock::now();
+    int numFrames = frameCount(params);
+    for (int i = 0; i < numFrames; i++) {
+        if (i > 0) {
+            contextSwap(context);
+        }
+        CHECK_STATUS(openglRender(params));
+        params.framesDrawn++;
+    }
+    GL_CHECKSTAGE("rendering");
+    steady_clock::duration renderTime = steady_clock::now() - timeStart;
+    params.renderTime = duration_cast<microseconds>(renderTime).count();
+    benchRecord(STAGE_DRAW, renderTime);
+    return EXIT_SUCCESS;
+}
+
+/*---------------------------------------------------------------------------*/
+
+// With a variants file, the program is only compiled, linked and reflected
+// once, then drawn with each of its uniform sets, whose entries override
+// those of the JSON file or defaults. Variant i is written like sequence
+// frame i.
+
+static void mergeVariant(UniformSet& uniforms, const UniformSet& base, const UniformSet& variant) {
+    uniforms = base;
+    for (UniformSet::const_iterator it = variant.begin(); it != variant.end(); ++it) {
+        uniforms[it->first] = it->second;
+    }
+}
+
+static JobStatus renderEachVariant(Params& params, Context& context, const UniformSet& base, const std::vector<UniformSet>& variants) {
+    int64_t renderTime = 0;
+    int64_t readbackTime = 0;
+    int64_t encodeTime = 0;
+    UniformLayout layout;
+    UniformPlan plan;
+    CHECK_STATUS(reflectUniforms(layout, params.program, params));
+    for (size_t i = 0; i < variants.size(); i++) {
+        {
+            BenchTimer timer(STAGE_UNIFORMS);
+            UniformSet uniforms;
+            mergeVariant(uniforms, base, variants[i]);
+            CHECK_STATUS(buildUniformPlan(plan, layout, uniforms));
+            CHECK_STATUS(applyUniformPlan(plan, params));
+        }
+        CHECK_STATUS(renderFrames(params, context));
+        renderTime += params.renderTime;
+
+        Params variant = params;
+        setIndexedOutput(variant, (int) i);
+        std::vector<std::uint8_t> data;
+        steady_clock::time_point timeStart = steady_clock::now();
+        CHECK_STATUS(readImage(variant, context, data));
+        readbackTime += duration_cast<microseconds>(steady_clock::now() - timeStart).count();
+        timeStart = steady_clock::now();
+        CHECK_STATUS(outputIndexed(variant, "variant", (int) i, data));
+        encodeTime += duration_cast<microseconds>(steady_clock::now() - timeStart).count();
+        params.variantsDrawn++;
+    }
+    params.renderTime = renderTime;
+    params.readbackTime = readbackTime;
+    params.encodeTime = encodeTime;
+    return EXIT_SUCCESS;
+}
+
+/*---------------------------------------------------------------------------*/
+
+// With --atlas, variants are drawn side by side into the framebuffer, up to
+// ATLAS_MAX_SIZE x ATLAS_MAX_SIZE pixels at a time, then each atlas is read
+// back at once and split into the images. Their uniform plans are built up
+// front, so that each tile only applies its plan and draws. Through
+// _GLF_tileOffset, shaders see their tile at the origin.
+
+#define ATLAS_MAX_SIZE (4096)
+
+typedef struct {
+    int columns;
+    int rows;
+} AtlasLayout;
+
+static AtlasLayout atlasLayout(const Params& params, const Context& context, size_t variants) {
+    AtlasLayout layout;
+    int maxSize = std::min(context.framebuffer.maxSize, ATLAS_MAX_SIZE);
+    layout.columns = std::min((int) variants, maxSize / params.width);
+    layout.rows = 0;
+    if (layout.columns > 0) {
+        int rows = ((int) variants + layout.columns - 1) / layout.columns;
+        layout.rows = std::min(rows, maxSize / params.height);
+    }
+    return layout;
+}
+
+// Draw variants first to first + count - 1 into tiles of atlas
+
+static JobStatus drawAtlas(Params& params, const std::vector<UniformPlan>& plans, size_t first, size_t count, int columns, GLint offsetLoc) {
+    int numFrames = frameCount(params);
+    for (int f = 0; f < numFrames; f++) {
+        for (size_t t = 0; t < count; t++) {
+            int x = (int) (t % columns) * params.width;
+            int y = (int) (t / columns) * params.height;
+            GL_SAFECALL(glViewport, x, y, params.width, params.height);
+            GL_SAFECALL(glScissor, x, y, params.width, params.height);
+            CHECK_STATUS(applyUniformPlan(plans[first + t], params));
+            // Not found when the shader does not use gl_FragCoord
+            if (offsetLoc != -1) {
+                GL_SAFECALL(glUniform2f, offsetLoc, (float) -x, (float) -y);
+            }
+            CHECK_STATUS(openglRender(params));
+            params.framesDrawn++;
+        }
+    }
+    GL_CHECKSTAGE("rendering");
+    return EXIT_SUCCESS;
+}
+
+static JobStatus renderAtlases(Params& params, Context& context, const std::vector<UniformPlan>& plans, const AtlasLayout& layout) {
+    Framebuffer& fb = context.framebuffer;
+    GLint offsetLoc = glGetUniformLocation(params.program, "_GLF_tileOffset");
+    GL_CHECKERR("glGetUniformLocation");
+
+    Params atlas = params;
+    atlas.width = layout.columns * params.width;
+    atlas.height = layout.rows * params.height;
+    CHECK_STATUS(framebufferBind(fb, params, atlas.width, atlas.height));
+    std::vector<std::uint8_t> pixels((size_t) atlas.width * atlas.height * CHANNELS);
+    size_t imageRow = (size_t) params.width * CHANNELS;
+    size_t atlasRow = (size_t) atlas.width * CHANNELS;
+    size_t perAtlas = (size_t) (layout.columns * layout.rows);
+
+    int64_t renderTime = 0;
+    int64_t readbackTime = 0;
+    int64_t encodeTime = 0;
+    for (size_t first = 0; first < plans.size(); first += perAtlas) {
+        size_t count = std::min(perAtlas, plans.size() - first);
+        steady_clock::time_point timeStart = steady_clock::now();
+        CHECK_STATUS(drawAtlas(params, plans, first, count, layout.columns, offsetLoc));
+        steady_clock::duration drawTime = steady_clock::now() - timeStart;
+        renderTime += duration_cast<microseconds>(drawTime).count();
+        benchRecord(STAGE_DRAW, drawTime);
+
+        timeStart = steady_clock::now();
+        {
+            BenchTimer timer(STAGE_READBACK);
+            CHECK_STATUS(framebufferRead(atlas, 0, 0, atlas.width, atlas.height, pixels));
+            GL_CHECKSTAGE("readback");
+        }
+        readbackTime += duration_cast<microseconds>(steady_clock::now() - timeStart).count();
+
+        timeStart = steady_clock::now();
+        for (size_t t = 0; t < count; t++) {
+            size_t x = (t % layout.columns) * imageRow;
+            size_t y = (t / layout.columns) * params.height;
+            std::vector<std::uint8_t> data((size_t) params.height * imageRow);
+            for (int h = 0; h < params.height; h++) {
+                memcpy(&data[h * imageRow], &pixels[(y + h) * atlasRow + x], imageRow);
+            }
+            Params variant = params;
+            setIndexedOutput(variant, (int) (first + t));
+            CHECK_STATUS(outputIndexed(variant, "variant", (int) (first + t), data));
+            params.variantsDrawn++;
+        }
+        encodeTime += duration_cast<microseconds>(steady_clock::now() - timeStart).count();
+    }
+    params.renderTime = renderTime;
+    params.readbackTime = readbackTime;
+    params.encodeTime = encodeTime;
+    return EXIT_SUCCESS;
+}
+
+static JobStatus renderAtlas(Params& params, Context& context, const UniformSet& base, const std::vector<UniformSet>& variants, const AtlasLayout& layout) {
+    std::vector<UniformPlan> plans(variants.size());
+    {
+        BenchTimer timer(STAGE_UNIFORMS);
+        UniformLayout uniformLayout;
+        CHECK_STATUS(reflectUniforms(uniformLayout, params.program, params));
+        for (size_t i = 0; i < variants.size(); i++) {
+            UniformSet uniforms;
+            mergeVariant(uniforms, base, variants[i]);
+            CHECK_STATUS(buildUniformPlan(plans[i], uniformLayout, uniforms));
+        }
+    }
+
+    // The scissor keeps the clear of each tile within it
+    GL_SAFECALL(glEnable, GL_SCISSOR_TEST);
+    JobStatus status = renderAtlases(params, context, plans, layout);
+    glDisable(GL_SCISSOR_TEST);
+    GL_SAFECALL(glViewport, 0, 0, params.width, params.height);
+    return status;
+}
+
+/*---------------------------------------------------------------------------*/
+
+static JobStatus renderVariants(Params& params, Context& context) {
+    if (!hasOutput(params)) {
+        return EXIT_SUCCESS;
+    }
+    if (params.sequenceFrames > 0) {
+        error_return("Variants and --frames are exclusive");
+    }
+    std::vector<UniformSet> variants;
+    {
+        BenchTimer timer(STAGE_JSON_PARSE);
+        CHECK_STATUS(uniformVariantsLoad(params.variantsFilename, variants));
+    }
+    std::shared_ptr<const UniformSet> base;
+    CHECK_STATUS(loadUniformSet(params, base));
+
+    // Images that need tiles of their own, or that do not fit twice, are
+    // drawn one by one
+    if (params.atlas && !isTiled(params, context)) {
+        AtlasLayout layout = atlasLayout(params, context, variants.size());
+        if (layout.columns * layout.rows > 1) {
+            return renderAtlas(params, context, *base, variants, layout);
+        }
+    }
+    return renderEachVariant(params, context, *base, variants);
+}
+
+/*---------------------------------------------------------------------------*/
+
+// Jobs of a batch share the context created for the first one, whose API
+// may not take the shader of a later job: OpenGLES only compiles ES
+// shaders, and OpenGL only compiles them with the matching OpenGLES
+// compatibility, core from 4.1 (100), 4.3 (300 es) and 4.5 (310 es).
+
+static JobStatus checkSharedContext(const Params& params) {
+    if (params.batchFilename == "" && params.benchDir == "") {
+        return EXIT_SUCCESS;
+    }
+    bool es = params.shaderProfile == PROFILE_ES;
+    bool supported = es || params.API == API_OPENGL;
+    if (es && params.API == API_OPENGL) {
+        switch (params.shaderVersion) {
+        case 100:
+            supported = params.APIVersion >= 410 || openglHasExtension(params, "GL_ARB_ES2_compatibility");
+            break;
+        case 300:
+            supported = params.APIVersion >= 430 || openglHasExtension(params, "GL_ARB_ES3_compatibility");
+            break;
+        case 310:
+            supported = params.APIVersion >= 450 || openglHasExtension(params, "GL_ARB_ES3_1_compatibility");
+            break;
+        default:
+            supported = openglHasExtension(params, "GL_ARB_ES3_2_compatibility");
+            break;
+        }
+    }
+    if (!supported) {
+        error_return("GLSL %d%s shader, but the context of the batch is %s %d.%d, created for the first job: render it in a batch of its own",
+                     params.shaderVersion, es ? " es" : "", params.API == API_OPENGL ? "OpenGL" : "OpenGLES",
+                     params.APIVersion / 100, (params.APIVersion % 100) / 10);
+    }
+    return EXIT_SUCCESS;
+}
+
+/*---------------------------------------------------------------------------*/
+
+static JobStatus renderJob(Params& params, Context& context) {
+    getDriverStrings(params);
+    FileContents fragContents;
+    {
+        BenchTimer timer(STAGE_FILE_READ);
+        CHECK_STATUS(fragContents.load(params.fragFilename));
+    }
+    CHECK_STATUS(getShaderVersion(params.shaderVersion, params.shaderProfile, fragContents));
+    CHECK_STATUS(checkSharedContext(params));
+    if (needsTileOffset(params, context)) {
+        addTileOffset(fragContents);
+    }
+    CHECK_STATUS(openglInit(params, fragContents));
+    if (params.variantsFilename != "") {
+        return renderVariants(params, context);
+    }
+    return renderFrames(params, context);
+}
+
+/*---------------------------------------------------------------------------*/
+
+// With parallel shader compilation, jobs are split in two steps: the
+// submission of their program, and its completion once ready.
+
+static JobStatus submitJob(Params& params, Context& context) {
+    getDriverStrings(params);
+    FileContents fragContents;
+    {
+        BenchTimer timer(STAGE_FILE_READ);
+        CHECK_STATUS(fragContents.load(params.fragFilename));
+    }
+    CHECK_STATUS(getShaderVersion(params.shaderVersion, params.shaderProfile, fragContents));
+    CHECK_STATUS(checkSharedContext(params));
+    if (needsTileOffset(params, context)) {
+        addTileOffset(fragContents);
+    }
+    return openglSubmitProgram(params, fragContents);
+}
+
+/*---------------------------------------------------------------------------*/
+
+static JobStatus completeJob(Params& params, Context& context) {
+    CHECK_STATUS(openglFinishInit(params));
+    if (params.variantsFilename != "") {
+        return renderVariants(params, context);
+    }
+    return renderFrames(params, context);
+}
+
+/*---------------------------------------------------------------------------*/
+
+typedef JobStatus (*JobStep)(Params& params, Context& context);
+
+// Exceptions (e.g. std::bad_alloc) must not take the worker down either.
+
+static JobStatus runStep(JobStep step, Params& params, Context& context) {
+    try {
+        return step(params, context);
+    } catch (const std::exception& e) {
+        printf("ERROR: %s\n", e.what());
+        return EXIT_FAILURE;
+    }
+}
+
+/*---------------------------------------------------------------------------*/
+
+// Without an output in the job, images go next to their shader. All jobs
+// share the mmap file.
+
+static void setDefaultOutput(Params& job) {
+    if (job.outputFormat != OUTPUT_MMAP) {
+        job.output = job.fragFilename;
+        job.output.replace(job.output.end()-4, job.output.end(), outputExtension(job.outputFormat));
+    }
+}
+
+/*---------------------------------------------------------------------------*/
+
+// Override the command line parameters with the entries of one batch
+// line. Throws on malformed entries.
+
+static void setJobParams(Params& job, const json& j, int index) {
+    job.fragFilename = j.at("shader").get<std::string>();
+    if (j.count("json")) {
+        job.jsonFilename = j["json"].get<std::string>();
+    }
+    if (j.count("output")) {
+        job.output = j["output"].get<std::string>();
+    } else {
+        setDefaultOutput(job);
+    }
+    if (j.count("reference")) {
+        job.reference = j["reference"].get<std::string>();
+    }
+    if (j.count("variants")) {
+        job.variantsFilename = j["variants"].get<std::string>();
+    }
+    if (j.count("resolution")) {
+        job.width = j["resolution"].at(0).get<int>();
+        job.height = j["resolution"].at(1).get<int>();
+    }
+    // By default, images of an mmap file follow each other in job order,
+    // which assumes they all have the same size
+    if (j.count("offset")) {
+        job.outputOffset = j["offset"].get<uint64_t>();
+    } else {
+        job.outputOffset += index * outputRawSize(job.width, job.height);
+    }
+}
+
+/*---------------------------------------------------------------------------*/
+
+typedef struct {
+    int index;
+    Params params;
+    size_t readbackSlot;
+    GpuTimes gpuTimes;
+} BatchJob;
+
+// Image of a job waiting for the PNG encoder threads
+typedef struct {
+    BatchJob job;
+    std::vector<std::uint8_t> data;
+} EncodeTask;
+
+// Per context state of the jobs being rendered
+typedef struct {
+    Context *context;
+    ReadbackRing readback;
+    std::deque<BatchJob> readbackJobs;  // Oldest first, same order as the ring
+    WorkQueue<EncodeTask> *encoder;     // NULL to encode on the render thread
+    bool gpuTimer;                      // Whether to time the draws of jobs
+} BatchWorker;
+
+/*---------------------------------------------------------------------------*/
+
+// With --metrics-fd, the result line of each job, plus what a harness
+// would otherwise scrape from the log, goes to its own file descriptor
+
+static FILE *metricsFile = NULL;
+
+static void openMetrics(const Params& params) {
+    if (params.metricsFd < 0) {
+        return;
+    }
+    metricsFile = fdopen(params.metricsFd, "w");
+    if (metricsFile == NULL) {
+        crash("Cannot write job records to file descriptor %d", params.metricsFd);
+    }
+}
+
+static void addTime(json& record, const char *name, int64_t time) {
+    if (time >= 0) {
+        record[name] = time;
+    }
+}
+
+static void writeMetrics(const json& result, const Params& params) {
+    if (metricsFile == NULL) {
+        return;
+    }
+    json record = result;
+    addTime(record, "render_time_us", params.renderTime);
+    addTime(record, "readback_time_us", params.readbackTime);
+    addTime(record, "encode_time_us", params.encodeTime);
+    if (params.infoLog != "") {
+        record["info_log"] = params.infoLog;
+    }
+    if (params.glRenderer != "") {
+        record["gl_vendor"] = params.glVendor;
+        record["gl_renderer"] = params.glRenderer;
+        record["gl_version"] = params.glVersion;
+    }
+    std::string line = record.dump() + "\n";
+    std::lock_guard<std::mutex> lock(resultMutex);
+    fputs(line.c_str(), metricsFile);
+    fflush(metricsFile);
+}
+
+/*---------------------------------------------------------------------------*/
+
+// With --memo, a job whose result is memoized is reported, with its image
+// copied from the earlier output, without compiling or rendering. Shaders
+// that animate or have variants, mmap images and PNG references are left
+// out.
+
+static bool memoUsable(const Params& params) {
+    return params.memoDir != "" && !isAnimated(params) && params.variantsFilename == "" &&
+           params.outputFormat != OUTPUT_MMAP && (params.reference == "" || isReferenceHash(params.reference));
+}
+
+// Results that only depend on the key are kept: images, whether or not
+// they match the reference, and compile or link errors. Other failures
+// may not happen again.
+
+static void memoizeJob(const BatchJob& job, JobStatus status, const ImageCheck *check) {
+    const Params& params = job.params;
+    if (params.memoKey == "" || params.memoHit) {
+        return;
+    }
+    MemoEntry entry;
+    entry.status = EXIT_SUCCESS;
+    entry.infoLog = params.infoLog;
+    entry.hashed = false;
+    entry.hash = 0;
+    if (status == COMPILE_ERROR_EXIT_CODE || status == LINK_ERROR_EXIT_CODE) {
+        entry.status = status;
+    } else if (hasOutput(params) && (status == EXIT_SUCCESS || status == MISMATCH_EXIT_CODE)) {
+        if (check == NULL || !check->hashed) {
+            return;
+        }
+        entry.hashed = true;
+        entry.hash = check->hash;
+        // Images that match their reference are not written
+        if (!check->compared || !check->match) {
+            entry.output = params.output;
+        }
+    } else if (status != EXIT_SUCCESS) {
+        return;
+    }
+    memoStore(params, entry);
+}
+
+static void reportJob(const BatchJob& job, JobStatus status, const ImageCheck *check = NULL) {
+    json result;
+    result["job"] = job.index;
+    result["shader"] = job.params.fragFilename;
+    result["output"] = job.params.output;
+    result["status"] = status;
+    result["frames"] = job.params.framesDrawn;
+    if (job.params.variantsFilename != "") {
+        result["variants"] = job.params.variantsDrawn;
+    }
+    if (job.params.memoHit) {
+        result["memo"] = true;
+    }
+    if (check != NULL) {
+        addCheckResult(result, *check);
+    }
+    addTimeResult(result, job.params, job.gpuTimes);
+    printResult(result);
+    writeMetrics(result, job.params);
+    memoizeJob(job, status, check);
+}
+
+/*---------------------------------------------------------------------------*/
+
+// Pixel buffers come back here once their image is written, so that jobs
+// reuse them rather than allocating, and zeroing, one image each
+static std::mutex bufferMutex;
+static std::vector<std::vector<std::uint8_t> > freeBuffers;
+
+static void takeBuffer(std::vector<std::uint8_t>& data) {
+    std::lock_guard<std::mutex> lock(bufferMutex);
+    if (!freeBuffers.empty()) {
+        data.swap(freeBuffers.back());
+        freeBuffers.pop_back();
+    }
+}
+
+static void recycleBuffer(std::vector<std::uint8_t>& data) {
+    std::lock_guard<std::mutex> lock(bufferMutex);
+    freeBuffers.push_back(std::vector<std::uint8_t>());
+    freeBuffers.back().swap(data);
+}
+
+/*---------------------------------------------------------------------------*/
+
+static void encodeJob(BatchJob& job, std::vector<std::uint8_t>& data) {
+    JobStatus status;
+    ImageCheck check;
+    steady_clock::time_point timeStart = steady_clock::now();
+    try {
+        status = outputImage(job.params, data, check);
+    } catch (const std::exception& e) {
+        printf("ERROR: %s\n", e.what());
+        status = EXIT_FAILURE;
+    }
+    job.params.encodeTime = duration_cast<microseconds>(steady_clock::now() - timeStart).count();
+    recycleBuffer(data);
+    reportJob(job, status, &check);
+}
+
+/*---------------------------------------------------------------------------*/
+
+// Save and report a job given its image, either right away or on the
+// encoder threads. Hands data over to them rather than copying it.
+
+static void outputJob(BatchWorker& worker, BatchJob& job, std::vector<std::uint8_t>& data) {
+    if (worker.encoder == NULL) {
+        encodeJob(job, data);
+        return;
+    }
+    EncodeTask task;
+    task.job = job;
+    task.data.swap(data);
+    // Blocks while the encoders are behind, so that images do not pile up
+    worker.encoder->push(std::move(task));
+}
+
+/*---------------------------------------------------------------------------*/
+
+// Save and report the oldest job whose image is being read back
+
+static void finishReadback(BatchWorker& worker) {
+    BatchJob job = worker.readbackJobs.front();
+    worker.readbackJobs.pop_front();
+    std::vector<std::uint8_t> data;
+    takeBuffer(data);
+    TraceSpan span("readbackFinish");
+    steady_clock::time_point timeStart = steady_clock::now();
+    JobStatus status = readbackFinish(worker.readback, job.readbackSlot, data);
+    job.params.readbackTime += duration_cast<microseconds>(steady_clock::now() - timeStart).count();
+    if (status != EXIT_SUCCESS) {
+        recycleBuffer(data);
+        reportJob(job, status);
+        return;
+    }
+    outputJob(worker, job, data);
+}
+
+/*---------------------------------------------------------------------------*/
+
+// Timing failures leave the job without GPU times, not failed: its image
+// is fine
+
+static void timeJob(const BatchWorker& worker, BatchJob& job) {
+    if (worker.gpuTimer && timeDraws(job.params, job.gpuTimes) != EXIT_SUCCESS) {
+        printf("Warning: no GPU times for job %d\n", job.index);
+    }
+}
+
+/*---------------------------------------------------------------------------*/
+
+// Finish a job whose step returned status, and leave the context clean for
+// the next job whatever the outcome. With asynchronous readback, the image
+// only gets saved, and the job reported, once a later job needs its buffer
+// or the worker is done. Variants are already written.
+
+static void finishJob(BatchWorker& worker, BatchJob& job, JobStatus status) {
+    if (status == EXIT_SUCCESS && hasOutput(job.params) && job.params.variantsFilename == "") {
+        // Pixel buffers only take images in one piece
+        bool async = !worker.readback.slots.empty() && !isTiled(job.params, *worker.context);
+        if (!async) {
+            std::vector<std::uint8_t> data;
+            takeBuffer(data);
+            steady_clock::time_point timeStart = steady_clock::now();
+            try {
+                status = readImage(job.params, *worker.context, data);
+            } catch (const std::exception& e) {
+                printf("ERROR: %s\n", e.what());
+                status = EXIT_FAILURE;
+            }
+            job.params.readbackTime = duration_cast<microseconds>(steady_clock::now() - timeStart).count();
+            if (status == EXIT_SUCCESS) {
+                timeJob(worker, job);
+                openglTerminate(job.params);
+                outputJob(worker, job, data);
+                return;
+            }
+        } else {
+            if (readbackFull(worker.readback)) {
+                finishReadback(worker);
+            }
+            // Plus the wait in finishReadback()
+            steady_clock::time_point timeStart = steady_clock::now();
+            status = readbackStart(worker.readback, job.params, job.readbackSlot);
+            job.params.readbackTime = duration_cast<microseconds>(steady_clock::now() - timeStart).count();
+            if (status == EXIT_SUCCESS) {
+                timeJob(worker, job);
+                worker.readbackJobs.push_back(job);
+                openglTerminate(job.params);
+                return;
+            }
+        }
+    }
+    openglTerminate(job.params);
+    reportJob(job, status);
+}
+
+/*---------------------------------------------------------------------------*/
+
+static JobStatus copyFile(const std::string& from, const std::string& to) {
+    if (from == to) {
+        return EXIT_SUCCESS;
+    }
+    std::ifstream ifs(from.c_str(), std::ios::binary);
+    std::ofstream ofs(to.c_str(), std::ios::binary);
+    ofs << ifs.rdbuf();
+    ofs.close();
+    if (!ifs || !ofs) {
+        error_return("Cannot copy %s to %s", from.c_str(), to.c_str());
+    }
+    return EXIT_SUCCESS;
+}
+
+// Returns true if the job was reported from the memo. Otherwise, its
+// params.memoKey is set if its result is to be memoized. Failures to read
+// the sources are left for the job to report.
+
+static bool memoJob(BatchJob& job, Context& context) {
+    Params& params = job.params;
+    if (!memoUsable(params)) {
+        return false;
+    }
+    getDriverStrings(params);
+    FileContents fragContents;
+    FileContents vertContents;
+    FileContents uniforms;
+    std::string jsonFilename = getJSONFilename(params);
+    if (!isFile(params.fragFilename) || fragContents.load(params.fragFilename) != EXIT_SUCCESS ||
+        getShaderVersion(params.shaderVersion, params.shaderProfile, fragContents) != EXIT_SUCCESS ||
+        generateVertexShader(vertContents, params) != EXIT_SUCCESS ||
+        (isFile(jsonFilename) && uniforms.load(jsonFilename) != EXIT_SUCCESS)) {
+        return false;
+    }
+    // The key is that of the source as compiled
+    if (needsTileOffset(params, context)) {
+        addTileOffset(fragContents);
+    }
+    params.memoKey = memoKey(params, vertContents, fragContents, uniforms);
+    MemoEntry entry;
+    if (!memoLoad(params, entry)) {
+        return false;
+    }
+
+    ImageCheck check;
+    check.hashed = entry.hashed;
+    check.hash = entry.hash;
+    check.compared = false;
+    check.match = false;
+    check.pixelDiff = false;
+    JobStatus status = entry.status;
+    bool image = status == EXIT_SUCCESS && hasOutput(params);
+    if (image) {
+        if (params.reference != "") {
+            check.compared = true;
+            check.match = (strtoull(params.reference.c_str(), NULL, 16) == check.hash);
+        }
+        if (!check.compared || !check.match) {
+            status = copyFile(entry.output, params.output);
+            if (status == EXIT_SUCCESS && check.compared) {
+                status = MISMATCH_EXIT_CODE;
+            }
+        }
+    }
+    params.infoLog = entry.infoLog;
+    params.memoHit = true;
+    reportJob(job, status, image ? &check : NULL);
+    return true;
+}
+
+/*---------------------------------------------------------------------------*/
+
+// Read the next job of the batch file. Malformed lines are reported as
+// failed jobs and skipped. Returns false at the end of the input.
+
+static bool readBatchJob(std::istream& in, const Params& params, int& jobIndex, BatchJob& job) {
+    std::string line;
+    while (std::getline(in, line)) {
+        if (line.find_first_not_of(" \t\r") == std::string::npos) {
+            continue;
+        }
+        job.index = jobIndex++;
+        job.params = params;
+        job.gpuTimes.count = 0;
+        try {
+            setJobParams(job.params, json::parse(line), job.index);
+        } catch (const std::exception& e) {
+            printf("ERROR: malformed batch job: %s\n", e.what());
+            json result;
+            result["job"] = job.index;
+            result["status"] = EXIT_FAILURE;
+            result["error"] = e.what();
+            printResult(result);
+            continue;
+        }
+        return true;
+    }
+    return false;
+}
+
+/*---------------------------------------------------------------------------*/
+
+// Render the jobs of the queue until it is closed. With parallel shader
+// compilation, up to params.parallelCompile jobs have their program
+// compiling in the background, and whichever is ready first is rendered.
+
+static void runBatchJobs(WorkQueue<BatchJob>& queue, BatchWorker& worker, const Params& params) {
+    Context& context = *worker.context;
+    size_t depth = (size_t) params.parallelCompile;
+    if (depth > 1 && !openglHasParallelCompile(params)) {
+        printf("Warning: no parallel shader compile support, compiling one shader at a time\n");
+        depth = 1;
+    }
+
+    BatchJob job;
+    if (depth <= 1) {
+        while (queue.pop(job)) {
+            if (!memoJob(job, context)) {
+                finishJob(worker, job, runStep(renderJob, job.params, context));
+            }
+        }
+        return;
+    }
+
+    std::deque<BatchJob> pending;
+    while (true) {
+        // Only wait for more jobs when there is nothing else to do
+        while (pending.size() < depth && (pending.empty() ? queue.pop(job) : queue.tryPop(job))) {
+            if (memoJob(job, context)) {
+                continue;
+            }
+            JobStatus status = runStep(submitJob, job.params, context);
+            if (status == EXIT_SUCCESS) {
+                pending.push_back(job);
+            } else {
+                openglTerminate(job.params);
+                reportJob(job, status);
+            }
+        }
+        if (pending.empty()) {
+            break;
+        }
+
+        // Render the first ready program, or else wait for the oldest one
+        size_t next = 0;
+        for (size_t i = 0; i < pending.size(); i++) {
+            if (openglProgramReady(pending[i].params)) {
+                next = i;
+                break;
+            }
+        }
+        job = pending[next];
+        pending.erase(pending.begin() + next);
+        finishJob(worker, job, runStep(completeJob, job.params, context));
+    }
+}
+
+/*---------------------------------------------------------------------------*/
+
+static void runBatchWorker(WorkQueue<BatchJob>& queue, Context& context, WorkQueue<EncodeTask>* encoder, const Params& params) {
+    openglInitErrors(params);
+    initFramebuffer(params, context);
+    BatchWorker worker;
+    worker.context = &context;
+    worker.encoder = encoder;
+    worker.gpuTimer = params.gpuTimeRepeats > 0;
+    if (worker.gpuTimer && !gpuTimerSupported(params)) {
+        printf("Warning: no GPU timer query support, jobs are not timed\n");
+        worker.gpuTimer = false;
+    }
+    if (params.asyncReadback > 0) {
+        if (!readbackSupported(params)) {
+            printf("Warning: no pixel buffer support, reading images back synchronously\n");
+        } else if (readbackInit(worker.readback, (size_t) params.asyncReadback) != EXIT_SUCCESS) {
+            printf("Warning: reading images back synchronously\n");
+            readbackTerminate(worker.readback);
+        }
+    }
+
+    runBatchJobs(queue, worker, params);
+
+    while (!worker.readbackJobs.empty()) {
+        finishReadback(worker);
+    }
+    readbackTerminate(worker.readback);
+    openglReleaseShared();
+    terminateFramebuffer(params, context);
+}
+
+/*---------------------------------------------------------------------------*/
+
+// The first line was read ahead, see batchFirstLine()
+
+static void batchReader(std::istream* in, std::string firstLine, WorkQueue<BatchJob>* queue, const Params* params) {
+    traceThreadName("reader");
+    int jobIndex = 0;
+    BatchJob job;
+    std::istringstream first(firstLine);
+    while (readBatchJob(first, *params, jobIndex, job)) {
+        queue->push(job);
+    }
+    while (readBatchJob(*in, *params, jobIndex, job)) {
+        queue->push(job);
+    }
+    queue->close();
+}
+
+/*---------------------------------------------------------------------------*/
+
+static void encoderThread(WorkQueue<EncodeTask>* encoder) {
+    traceThreadName("encoder");
+    EncodeTask task;
+    while (encoder->pop(task)) {
+        encodeJob(task.job, task.data);
+    }
+}
+
+/*---------------------------------------------------------------------------*/
+
+static void batchWorker(WorkQueue<BatchJob>* queue, const Context* mainContext, WorkQueue<EncodeTask>* encoder, const Params* params, int index) {
+    traceThreadName("worker " + std::to_string(index));
+    Context context;
+    TraceSpan initSpan("contextInitWorker");
+    contextInitWorker(*mainContext, context, *params);
+    initSpan.end();
+    runBatchWorker(*queue, context, encoder, *params);
+    contextTerminateWorker(context);
+}
+
+/*---------------------------------------------------------------------------*/
+
+// The context is created before any job is read, so it is chosen for the
+// shader of the first job, e.g. with GLFW, an ES context for a batch of ES
+// shaders. Returns the first line that is not blank, for the reader.
+// Errors are left for the job to report.
+
+static std::string batchFirstLine(std::istream& in, Params& params) {
+    std::string line;
+    while (std::getline(in, line) && line.find_first_not_of(" \t\r") == std::string::npos) {
+    }
+    Params first = params;
+    try {
+        setJobParams(first, json::parse(line), 0);
+    } catch (const std::exception&) {
+        return line;
+    }
+    FileContents fragContents;
+    int version;
+    SHADER_PROFILE profile;
+    if (isFile(first.fragFilename) && fragContents.load(first.fragFilename) == EXIT_SUCCESS &&
+        getShaderVersion(version, profile, fragContents) == EXIT_SUCCESS) {
+        params.shaderVersion = version;
+        params.shaderProfile = profile;
+    }
+    return line;
+}
+
+/*---------------------------------------------------------------------------*/
+
+static JobStatus runBatch(Params& params) {
+    std::ifstream ifs;
+    std::istream *in = &std::cin;
+    if (params.batchFilename != "-") {
+        ifs.open(params.batchFilename.c_str());
+        if (!ifs) {
+            crash("File not found: %s", params.batchFilename.c_str());
+        }
+        in = &ifs;
+    }
+
+    std::string firstLine = batchFirstLine(*in, params);
+    Context context;
+    TraceSpan initSpan("contextInitAndGetAPI");
+    contextInitAndGetAPI(params, context);
+    initSpan.end();
+
+    // Jobs are read on their own thread, so that waiting for input does
+    // not hold back rendering
+    WorkQueue<BatchJob> queue(2 * params.workers * params.parallelCompile);
+    std::thread reader(batchReader, in, firstLine, &queue, &params);
+
+    // PNG encoding is CPU bound: give it its own threads so that renderers
+    // move on to the next job meanwhile
+    WorkQueue<EncodeTask> encodeQueue(2 * params.pngThreads);
+    WorkQueue<EncodeTask> *encoder = NULL;
+    std::vector<std::thread> encoders;
+    if (params.pngThreads > 0) {
+        encoder = &encodeQueue;
+        for (int i = 0; i < params.pngThreads; i++) {
+            encoders.push_back(std::thread(encoderThread, encoder));
+        }
+    }
+
+    if (params.workers == 1) {
+        runBatchWorker(queue, context, encoder, params);
+    } else {
+        std::vector<std::thread> workers;
+        for (int i = 0; i < params.workers; i++) {
+            workers.push_back(std::thread(batchWorker, &queue, &context, encoder, &params, i));
+        }
+        for (size_t i = 0; i < workers.size(); i++) {
+            workers[i].join();
+        }
+    }
+    reader.join();
+
+    encodeQueue.close();
+    for (size_t i = 0; i < encoders.size(); i++) {
+        encoders[i].join();
+    }
+    outputTerminate();
+
+    contextTerminate(context);
+    if (params.programCache != "") {
+        programCachePrintStats();
+    }
+    if (params.memoDir != "") {
+        memoPrintStats();
+    }
+    return EXIT_SUCCESS;
+}
+
+/*---------------------------------------------------------------------------*/
+// Benchmark mode
+/*---------------------------------------------------------------------------*/
+
+// The .frag files of dir, sorted, so that runs go in the same order
+
+#ifndef _WIN32
+
+static void listShaders(const std::string& dir, std::vector<std::string>& shaders) {
+    DIR *d = opendir(dir.c_str());
+    if (d == NULL) {
+        crash("Cannot open directory: %s", dir.c_str());
+    }
+    struct dirent *entry;
+    while ((entry = readdir(d)) != NULL) {
+        std::string name(entry->d_name);
+        if (name.size() > 5 && name.compare(name.size() - 5, 5, ".frag") == 0) {
+            shaders.push_back(dir + "/" + name);
+        }
+    }
+    closedir(d);
+    std::sort(shaders.begin(), shaders.end());
+}
+
+#else
+
+static void listShaders(const std::string& dir, std::vector<std::string>& shaders) {
+    WIN32_FIND_DATAA data;
+    HANDLE find = FindFirstFileA((dir + "\\*.frag").c_str(), &data);
+    if (find == INVALID_HANDLE_VALUE) {
+        crash("Cannot open directory: %s", dir.c_str());
+    }
+    do {
+        shaders.push_back(dir + "\\" + data.cFileName);
+    } while (FindNextFileA(find, &data));
+    FindClose(find);
+    std::sort(shaders.begin(), shaders.end());
+}
+
+#endif
+
+/*---------------------------------------------------------------------------*/
+
+// One run of a shader, as a synchronous batch job would
+
+static JobStatus benchRun(Params& params, Context& context) {
+    CHECK_STATUS(runStep(renderJob, params, context));
+    if (!hasOutput(params)) {
+        return EXIT_SUCCESS;
+    }
+    std::vector<std::uint8_t> data;
+    CHECK_STATUS(readImage(params, context, data));
+    ImageCheck check;
+    return outputImage(params, data, check);
+}
+
+/*---------------------------------------------------------------------------*/
+
+// Render every shader of the corpus params.benchRepeats times, one after
+// the other on a single context, then print the report as a JSON line.
+// Its keys only ever get added to, so that reports of different builds,
+// drivers or versions can be compared.
+
+#define BENCH_FORMAT (1)
+
+static JobStatus runBench(Params& params) {
+    std::vector<std::string> shaders;
+    listShaders(params.benchDir, shaders);
+    if (shaders.empty()) {
+        crash("No .frag shader in: %s", params.benchDir.c_str());
+    }
+
+    benchEnable();
+    Context context;
+    {
+        BenchTimer timer(STAGE_CONTEXT_INIT);
+        TraceSpan span("contextInitAndGetAPI");
+        contextInitAndGetAPI(params, context);
+    }
+    openglInitErrors(params);
+    initFramebuffer(params, context);
+    getDriverStrings(params);
+
+    int failures = 0;
+    steady_clock::time_point timeStart = steady_clock::now();
+    for (int r = 0; r < params.benchRepeats; r++) {
+        for (size_t i = 0; i < shaders.size(); i++) {
+            Params job = params;
+            job.fragFilename = shaders[i];
+            setDefaultOutput(job);
+            if (benchRun(job, context) != EXIT_SUCCESS) {
+                failures++;
+            }
+            openglTerminate(job);
+        }
+    }
+    double elapsed = duration_cast<duration<double> >(steady_clock::now() - timeStart).count();
+    outputTerminate();
+    openglReleaseShared();
+    terminateFramebuffer(params, context);
+    contextTerminate(context);
+
+    int runs = params.benchRepeats * (int) shaders.size();
+    json report;
+    report["bench_format"] = BENCH_FORMAT;
+    report["context"] = GETIMAGE_CONTEXT_NAME;
+    report["gl_vendor"] = params.glVendor;
+    report["gl_renderer"] = params.glRenderer;
+    report["gl_version"] = params.glVersion;
+    report["shaders"] = shaders.size();
+    report["repeats"] = params.benchRepeats;
+    report["runs"] = runs;
+    report["failures"] = failures;
+    report["elapsed_s"] = elapsed;
+    report["shaders_per_sec"] = elapsed > 0.0 ? runs / elapsed : 0.0;
+    int64_t rss = benchPeakRSS();
+    if (rss >= 0) {
+        report["peak_rss_kib"] = rss;
+    }
+    benchReport(report);
+    std::cout << report.dump() << std::endl;
+    return failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+/*---------------------------------------------------------------------------*/
+// Main
+/*---------------------------------------------------------------------------*/
+
+// The image check and GPU times are left in check and times, for the job
+// record
+
+static JobStatus runSingle(Params& params, ImageCheck& check, GpuTimes& times) {
+    FileContents fragContents;
+    Context context;
+
+    CHECK_STATUS(fragContents.load(params.fragFilename));
+    CHECK_STATUS(getShaderVersion(params.shaderVersion, params.shaderProfile, fragContents));
+    TraceSpan initSpan("contextInitAndGetAPI");
+    contextInitAndGetAPI(params, context);
+    initSpan.end();
+    openglInitErrors(params);
+    getDriverStrings(params);
+    initFramebuffer(params, context);
+    if (needsTileOffset(params, context)) {
+        addTileOffset(fragContents);
+    }
+    CHECK_STATUS(openglInit(params, fragContents));
+    if (params.exitCompile || params.exitLinking) {
+        return EXIT_SUCCESS;
+    }
+    CHECK_STATUS(bindTarget(params, context));
+
+    if (params.sequenceFrames > 0 || params.variantsFilename != "") {
+        if (params.sequenceFrames > 0) {
+            CHECK_STATUS(renderSequence(params, context));
+        } else {
+            CHECK_STATUS(renderVariants(params, context));
+        }
+        outputTerminate();
+        openglReleaseShared();
+        terminateFramebuffer(params, context);
+        contextTerminate(context);
+        return EXIT_SUCCESS;
+    }
+
+    int numFrames = frameCount(params);
+    bool saved = false;
+    steady_clock::time_point timeStart = steady_clock::now();
+
+    while (contextKeepLooping(context)) {
+        CHECK_STATUS(openglRender(params));
+        GL_CHECKSTAGE("rendering");
+        params.framesDrawn++;
+
+        // Capture before the swap, which leaves the back buffer undefined
+        if (params.framesDrawn == numFrames && !saved) {
+            params.renderTime = duration_cast<microseconds>(steady_clock::now() - timeStart).count();
+            CHECK_STATUS(saveImage(params, context, check));
+            outputTerminate();
+            saved = true;
+            if (params.gpuTimeRepeats > 0) {
+                CHECK_STATUS(timeDraws(params, times));
+                json result;
+                addTimeResult(result, params, times);
+                std::cout << result.dump() << std::endl;
+            }
+            if (params.profile) {
+                printf("frames drawn: %d\n", params.framesDrawn);
+            }
+
+            if (params.programCache != "") {
+                programCachePrintStats();
+            }
+
+            if (params.persist) {
+                printf("Press any key to close the window...\n");
+                contextSetKeyCallback(context);
+            } else {
+                break;
+            }
+        }
+        contextSwap(context);
+    }
+    openglReleaseShared();
+    terminateFramebuffer(params, context);
+    contextTerminate(context);
+    return EXIT_SUCCESS;
+}
+
+/*---------------------------------------------------------------------------*/
+
+// Single shader mode, with its job record
+
+static JobStatus runSingleJob(Params& params) {
+    ImageCheck check;
+    check.hashed = false;
+    check.compared = false;
+    check.pixelDiff = false;
+    GpuTimes times;
+    times.count = 0;
+    JobStatus status = runSingle(params, check, times);
+
+    json result;
+    result["shader"] = params.fragFilename;
+    result["output"] = params.output;
+    result["status"] = status;
+    result["frames"] = params.framesDrawn;
+    addCheckResult(result, check);
+    addTimeResult(result, params, times);
+    writeMetrics(result, params);
+    return status;
+}
+
+/*---------------------------------------------------------------------------*/
+
+int main(int argc, char* argv[])
+{
+    Params params;
+
+    setParams(params, argc, argv);
+    openglSetErrorPolicy(params);
+    openMetrics(params);
+    if (params.traceFile != "") {
+        traceEnable();
+        traceThreadName("main");
+    }
+
+    JobStatus status;
+    if (params.batchFilename != "") {
+        status = runBatch(params);
+    } else if (params.benchDir != "") {
+        status = runBench(params);
+    } else {
+        status = runSingleJob(params);
+    }
+    if (params.traceFile != "" && traceWrite(params.traceFile) != EXIT_SUCCESS && status == EXIT_SUCCESS) {
+        status = EXIT_FAILURE;
+    }
+    exit(status);
 }
 
 /*---------------------------------------------------------------------------*/
@@ -0,0 +1,211 @@
+#include <atomic>
+#include <fstream>
+#include <ctype.h>
+#include <stdio.h>
+#include <sys/stat.h>
+
+#include "memo.h"
+#include "hash.h"
+#include "output.h"
+#include "json.hpp"
+
+using json = nlohmann::json;
+
+/*---------------------------------------------------------------------------*/
+
+static std::atomic<int> memoHits(0);
+static std::atomic<int> memoMisses(0);
+
+// Changes of the key or of the entries invalidate older memos
+#define MEMO_FORMAT (2)
+
+/*---------------------------------------------------------------------------*/
+// Normalization
+/*---------------------------------------------------------------------------*/
+
+// Dots count with names and numbers, so that "a .5" keeps its space:
+// normalizing may miss duplicates, but must not merge different shaders
+
+static bool isWordChar(char c) {
+    return isalnum((unsigned char) c) || c == '_' || c == '.';
+}
+
+// As in the preprocessor, a block comment is one space even across lines,
+// while line comments leave their end of line
+
+void memoNormalize(const char *data, size_t size, std::string& out) {
+    out.clear();
+    out.reserve(size);
+    bool space = false;     // Whitespace since the last character kept
+    bool newline = false;   // Including an end of line
+    size_t i = 0;
+    while (i < size) {
+        char c = data[i];
+        if (c == '/' && i + 1 < size && data[i + 1] == '/') {
+            while (i < size && data[i] != '\n') {
+                i++;
+            }
+            continue;
+        }
+        if (c == '/' && i + 1 < size && data[i + 1] == '*') {
+            i += 2;
+            while (i + 1 < size && !(data[i] == '*' && data[i + 1] == '/')) {
+                i++;
+            }
+            i += 2;
+            space = true;
+            continue;
+        }
+        if (c == '\n') {
+            newline = true;
+            i++;
+            continue;
+        }
+        if (c == ' ' || c == '\t' || c == '\r' || c == '\f' || c == '\v') {
+            space = true;
+            i++;
+            continue;
+        }
+        if (!out.empty()) {
+            if (newline) {
+                out += '\n';
+            } else if (space && isWordChar(out.back()) == isWordChar(c)) {
+                out += ' ';
+            }
+        }
+        space = false;
+        newline = false;
+        out += c;
+        i++;
+    }
+}
+
+/*---------------------------------------------------------------------------*/
+// Entries
+/*---------------------------------------------------------------------------*/
+
+static std::string memoFilename(const Params& params) {
+    return params.memoDir + "/" + params.memoKey + ".json";
+}
+
+// Size and hash of the image file, false if it is gone
+
+static bool hashOutput(const std::string& filename, int64_t& size, uint64_t& hash) {
+    struct stat st;
+    if (stat(filename.c_str(), &st) != 0) {
+        return false;
+    }
+    FileContents contents;
+    if (contents.load(filename) != EXIT_SUCCESS) {
+        return false;
+    }
+    size = (int64_t) st.st_size;
+    hash = hash64(contents.data(), contents.size());
+    return true;
+}
+
+static uint64_t hashNormalized(const FileContents& contents, uint64_t seed) {
+    std::string normalized;
+    memoNormalize(contents.data(), contents.size(), normalized);
+    return hash64(normalized, seed);
+}
+
+/*---------------------------------------------------------------------------*/
+
+std::string memoKey(const Params& params, const FileContents& vertContents, const FileContents& fragContents, const FileContents& uniforms) {
+    int64_t format = MEMO_FORMAT;
+    uint64_t h = hash64(&format, sizeof(format));
+    h = hashNormalized(vertContents, h);
+    h = hashNormalized(fragContents, h);
+    h = hash64(uniforms.data(), uniforms.size(), h);
+
+    // Whatever else changes the image, or the file it is written to
+    int64_t fields[] = {
+        params.API, params.APIVersion, params.width, params.height,
+        params.delay, params.animate, params.fboFormat, params.outputFormat,
+        params.flip, params.pngLevel, params.exitCompile, params.exitLinking
+    };
+    h = hash64(fields, sizeof(fields), h);
+    h = hash64(params.glVendor, h);
+    h = hash64(params.glRenderer, h);
+    h = hash64(params.glVersion, h);
+    return hashToString(h);
+}
+
+/*---------------------------------------------------------------------------*/
+
+bool memoLoad(const Params& params, MemoEntry& entry) {
+    std::ifstream ifs(memoFilename(params).c_str());
+    if (!ifs) {
+        memoMisses++;
+        return false;
+    }
+    try {
+        json j = json::parse(ifs);
+        entry.status = j.at("status").get<JobStatus>();
+        entry.infoLog = j.value("info_log", "");
+        entry.hashed = j.count("hash") > 0;
+        entry.hash = entry.hashed ? strtoull(j["hash"].get<std::string>().c_str(), NULL, 16) : 0;
+        entry.output = j.value("output", "");
+        entry.outputSize = j.value("output_size", (int64_t) -1);
+        entry.outputHash = strtoull(j.value("output_hash", "").c_str(), NULL, 16);
+    } catch (const std::exception&) {
+        memoMisses++;
+        return false;
+    }
+
+    // Images that matched their reference were not written, so they are
+    // only known to the jobs that match it too
+    bool image = entry.status == EXIT_SUCCESS && entry.hashed;
+    bool match = isReferenceHash(params.reference) && strtoull(params.reference.c_str(), NULL, 16) == entry.hash;
+    if (image && entry.output == "" && !match) {
+        memoMisses++;
+        return false;
+    }
+    if (entry.output != "") {
+        int64_t size;
+        uint64_t hash;
+        if (!hashOutput(entry.output, size, hash) || size != entry.outputSize || hash != entry.outputHash) {
+            memoMisses++;
+            return false;
+        }
+    }
+    memoHits++;
+    return true;
+}
+
+/*---------------------------------------------------------------------------*/
+
+void memoStore(const Params& params, const MemoEntry& entry) {
+    json j;
+    j["status"] = entry.status;
+    if (entry.infoLog != "") {
+        j["info_log"] = entry.infoLog;
+    }
+    if (entry.hashed) {
+        j["hash"] = hashToString(entry.hash);
+    }
+    if (entry.output != "") {
+        int64_t size;
+        uint64_t hash;
+        if (!hashOutput(entry.output, size, hash)) {
+            return;
+        }
+        j["output"] = entry.output;
+        j["output_size"] = size;
+        j["output_hash"] = hashToString(hash);
+    }
+
+    std::string filename = memoFilename(params);
+    if (!writeFileAtomic(filename, j.dump() + "\n")) {
+        printf("Warning: cannot write memo entry: %s\n", filename.c_str());
+    }
+}
+
+/*---------------------------------------------------------------------------*/
+
+void memoPrintStats() {
+    printf("memo: %d hits, %d misses\n", memoHits.load(), memoMisses.load());
+}
+
+/*---------------------------------------------------------------------------*/
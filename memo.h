@@ -0,0 +1,50 @@
+#ifndef __GETIMAGE_MEMO__
+#define __GETIMAGE_MEMO__
+
+#include <stdint.h>
+#include <string>
+
+#include "common.h"
+#include "filemap.h"
+
+/*---------------------------------------------------------------------------*/
+// On-disk memo of batch job results, in the params.memoDir directory.
+// Entries are keyed by the shader sources up to comments and whitespace,
+// the uniforms, the image size and format, and the driver identity, so
+// that duplicate shaders of a corpus are neither compiled nor rendered
+// again.
+/*---------------------------------------------------------------------------*/
+
+typedef struct {
+    JobStatus status;       // EXIT_SUCCESS, or a compile or link error code
+    std::string infoLog;
+    bool hashed;
+    uint64_t hash;          // Of the image, if hashed
+    std::string output;     // Image file, "" if none was written
+    int64_t outputSize;     // Of the image file when stored, to tell if it
+    uint64_t outputHash;    // was overwritten since
+} MemoEntry;
+
+// Comments are removed, and whitespace only kept as one space where it
+// separates two names or numbers, or two operators, or as the end of a
+// line.
+void memoNormalize(const char *data, size_t size, std::string& out);
+
+// Uniforms are the contents of the JSON file, empty for the defaults.
+// The driver strings must be in params.
+std::string memoKey(const Params& params, const FileContents& vertContents, const FileContents& fragContents, const FileContents& uniforms);
+
+// Read the entry of params.memoKey. Returns false on a miss, including an
+// image file that is gone or was overwritten, or that was not written but
+// is needed, i.e. unless the image matches params.reference. The image
+// file is hashed again: timestamps are too coarse to tell a rewrite.
+bool memoLoad(const Params& params, MemoEntry& entry);
+
+// Failures are only warned about: the memo is an optimisation.
+void memoStore(const Params& params, const MemoEntry& entry);
+
+void memoPrintStats();
+
+/*---------------------------------------------------------------------------*/
+
+#endif
@@ -1,13 +1,19 @@
 #ifndef __GETIMAGE_OPENGLCONTEXT__
 #define __GETIMAGE_OPENGLCONTEXT__
 
-#define CONTEXT_EGL  1
-#define CONTEXT_GLFW 2
+#define CONTEXT_EGL      1
+#define CONTEXT_GLFW     2
+#define CONTEXT_HEADLESS 3
 
 #if   (GETIMAGE_CONTEXT == CONTEXT_EGL)
 #include "context_egl.h"
+#define GETIMAGE_CONTEXT_NAME "egl"
 #elif (GETIMAGE_CONTEXT == CONTEXT_GLFW)
 #include "context_glfw.h"
+#define GETIMAGE_CONTEXT_NAME "glfw"
+#elif (GETIMAGE_CONTEXT == CONTEXT_HEADLESS)
+#include "context_headless.h"
+#define GETIMAGE_CONTEXT_NAME "headless"
 #else
 #error Must define an OpenGL context preprocessor macro!
 #endif
@@ -18,23 +24,47 @@
 void contextInitAndGetAPI(Params& params, Context& ctx);
 bool contextKeepLooping(Context &ctx);
 void contextSwap(Context& ctx);
+void contextResize(Context& ctx, int width, int height);
 void contextSetKeyCallback(Context& ctx);
 void contextTerminate(Context& ctx);
 
+// Additional contexts for batch worker threads, to be called from the
+// worker thread itself
+void contextInitWorker(const Context& main, Context& ctx, const Params& params);
+void contextTerminateWorker(Context& ctx);
+
 /*---------------------------------------------------------------------------*/
 // This one is defined is main.cpp, but used in the macro belows
 
 const char *openglErrorString(GLenum err);
 
+// Defined in openglext.cpp: the errors since the last call, attributed to
+// stage. Does nothing with the strict policy, whose errors are caught call
+// by call.
+JobStatus openglCheckStage(const char *stage);
+
 /*---------------------------------------------------------------------------*/
 
+// On error, these macros return EXIT_FAILURE from the calling function,
+// which must therefore return a JobStatus.
+
+// Only set before any thread starts, by openglSetErrorPolicy()
+extern bool openglCheckEachCall;
+
+// Each glGetError() may be a round trip to the driver: unless strict,
+// errors are only looked for at the end of stages, by GL_CHECKSTAGE
+
 #define GL_CHECKERR(strfunc) do {                                       \
-        GLenum __err = glGetError();                                    \
-        if (__err != GL_NO_ERROR) {                                     \
-            crash("OpenGL error: %s(): %s" , strfunc, openglErrorString(__err)); \
+        if (openglCheckEachCall) {                                      \
+            GLenum __err = glGetError();                                \
+            if (__err != GL_NO_ERROR) {                                 \
+                error_return("OpenGL error: %s(): %s" , strfunc, openglErrorString(__err)); \
+            }                                                           \
         }                                                               \
     } while (0)
 
+#define GL_CHECKSTAGE(stage) CHECK_STATUS(openglCheckStage(stage))
+
 /*---------------------------------------------------------------------------*/
 
 #define GL_SAFECALL(func, ...) do  {                    \
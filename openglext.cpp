@@ -0,0 +1,178 @@
+#include <mutex>
+#include <string>
+#include <string.h>
+
+#include "openglext.h"
+
+/*---------------------------------------------------------------------------*/
+
+bool openglHasExtension(const Params& params, const char *name) {
+    if (params.APIVersion < 300) {
+        // No glGetStringi() before OpenGL 3.0 and OpenGLES 3.0, look for the
+        // name in the legacy list
+        const char *list = (const char *) glGetString(GL_EXTENSIONS);
+        size_t len = strlen(name);
+        for (const char *p = list; p != NULL && (p = strstr(p, name)) != NULL; p += len) {
+            if ((p == list || p[-1] == ' ') && (p[len] == ' ' || p[len] == '\0')) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    GLint numExtensions = 0;
+    glGetIntegerv(GL_NUM_EXTENSIONS, &numExtensions);
+    for (GLint i = 0; i < numExtensions; i++) {
+        const char *ext = (const char *) glGetStringi(GL_EXTENSIONS, i);
+        if (ext != NULL && strcmp(ext, name) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/*---------------------------------------------------------------------------*/
+
+bool openglHasParallelCompile(const Params& params) {
+    return openglHasExtension(params, "GL_KHR_parallel_shader_compile")
+        || openglHasExtension(params, "GL_ARB_parallel_shader_compile");
+}
+
+/*---------------------------------------------------------------------------*/
+// Error policy
+/*---------------------------------------------------------------------------*/
+
+bool openglCheckEachCall = true;
+static GL_ERRORS errorPolicy = GL_ERRORS_STRICT;
+
+// Errors reported by the debug callback of a context. Though synchronous,
+// the callback may run on a driver thread, hence the lock; userParam keeps
+// it tied to the context of the thread that set it up.
+typedef struct {
+    std::mutex mutex;
+    bool enabled;
+    int count;
+    std::string message;    // Of the first error
+} DebugErrors;
+
+static thread_local DebugErrors debugErrors;
+
+/*---------------------------------------------------------------------------*/
+
+#if (GETIMAGE_CONTEXT == CONTEXT_GLFW)
+#define DEBUG_APIENTRY APIENTRY
+#else
+#define DEBUG_APIENTRY GL_APIENTRY
+#endif
+
+typedef void (DEBUG_APIENTRY *DebugProc)(GLenum source, GLenum type, GLuint id, GLenum severity, GLsizei length, const GLchar *message, const void *userParam);
+typedef void (DEBUG_APIENTRY *DebugMessageCallbackProc)(DebugProc callback, const void *userParam);
+typedef void (DEBUG_APIENTRY *DebugMessageControlProc)(GLenum source, GLenum type, GLenum severity, GLsizei count, const GLuint *ids, GLboolean enabled);
+
+static void DEBUG_APIENTRY debugCallback(GLenum source, GLenum type, GLuint id, GLenum severity, GLsizei length, const GLchar *message, const void *userParam) {
+    if (type != GL_DEBUG_TYPE_ERROR) {
+        return;
+    }
+    DebugErrors *errors = (DebugErrors *) userParam;
+    std::lock_guard<std::mutex> lock(errors->mutex);
+    if (errors->count++ == 0) {
+        errors->message = message;
+    }
+}
+
+static void *getProcAddress(const char *name) {
+#if (GETIMAGE_CONTEXT == CONTEXT_GLFW)
+    return (void *) glfwGetProcAddress(name);
+#else
+    return (void *) eglGetProcAddress(name);
+#endif
+}
+
+/*---------------------------------------------------------------------------*/
+
+void openglSetErrorPolicy(const Params& params) {
+    errorPolicy = params.glErrors;
+    openglCheckEachCall = errorPolicy == GL_ERRORS_STRICT;
+}
+
+/*---------------------------------------------------------------------------*/
+
+// Core in OpenGL 4.3 and OpenGLES 3.2. The extension has no suffix on
+// OpenGL, but the KHR one on OpenGLES.
+
+void openglInitErrors(const Params& params) {
+    debugErrors.enabled = false;
+    debugErrors.count = 0;
+    if (errorPolicy != GL_ERRORS_DEBUG) {
+        return;
+    }
+
+    const char *suffix = NULL;
+    if ((params.API == API_OPENGL && params.APIVersion >= 430) ||
+        (params.API == API_OPENGL_ES && params.APIVersion >= 320)) {
+        suffix = "";
+    } else if (openglHasExtension(params, "GL_KHR_debug")) {
+        suffix = params.API == API_OPENGL_ES ? "KHR" : "";
+    }
+    DebugMessageCallbackProc callback = NULL;
+    DebugMessageControlProc control = NULL;
+    if (suffix != NULL) {
+        callback = (DebugMessageCallbackProc) getProcAddress((std::string("glDebugMessageCallback") + suffix).c_str());
+        control = (DebugMessageControlProc) getProcAddress((std::string("glDebugMessageControl") + suffix).c_str());
+    }
+    if (callback == NULL || control == NULL) {
+        printf("Warning: no GL_KHR_debug support, checking OpenGL errors once per stage\n");
+        return;
+    }
+
+    // Only errors: other messages would cost a call each for nothing
+    control(GL_DONT_CARE, GL_DONT_CARE, GL_DONT_CARE, 0, NULL, GL_FALSE);
+    control(GL_DONT_CARE, GL_DEBUG_TYPE_ERROR, GL_DONT_CARE, 0, NULL, GL_TRUE);
+    callback(debugCallback, &debugErrors);
+    // Otherwise the driver may call back later, from a thread of its own,
+    // and an error could reach the checks of the next stage or job. This
+    // costs drivers their own thread, not a round trip per call.
+    glEnable(GL_DEBUG_OUTPUT_SYNCHRONOUS);
+    glEnable(GL_DEBUG_OUTPUT);
+    debugErrors.enabled = glGetError() == GL_NO_ERROR;
+    if (!debugErrors.enabled) {
+        printf("Warning: cannot enable debug output, checking OpenGL errors once per stage\n");
+    }
+}
+
+/*---------------------------------------------------------------------------*/
+
+JobStatus openglCheckStage(const char *stage) {
+    if (errorPolicy == GL_ERRORS_STRICT) {
+        return EXIT_SUCCESS;
+    }
+    if (debugErrors.enabled) {
+        std::lock_guard<std::mutex> lock(debugErrors.mutex);
+        if (debugErrors.count == 0) {
+            return EXIT_SUCCESS;
+        }
+        int count = debugErrors.count;
+        debugErrors.count = 0;
+        error_return("OpenGL error during %s: %s (%d error(s))", stage, debugErrors.message.c_str(), count);
+    }
+    GLenum err = glGetError();
+    if (err != GL_NO_ERROR) {
+        openglClearErrors();
+        error_return("OpenGL error during %s: %s", stage, openglErrorString(err));
+    }
+    return EXIT_SUCCESS;
+}
+
+/*---------------------------------------------------------------------------*/
+
+void openglClearErrors() {
+    // Bounded, as a lost context may keep reporting errors
+    for (int i = 0; i < 16 && glGetError() != GL_NO_ERROR; i++) {
+    }
+    if (debugErrors.enabled) {
+        std::lock_guard<std::mutex> lock(debugErrors.mutex);
+        debugErrors.count = 0;
+    }
+}
+
+/*---------------------------------------------------------------------------*/
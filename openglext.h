@@ -0,0 +1,53 @@
+#ifndef __GETIMAGE_OPENGLEXT__
+#define __GETIMAGE_OPENGLEXT__
+
+#include "openglcontext.h"
+
+/*---------------------------------------------------------------------------*/
+// Optional OpenGL / OpenGLES extensions. The bundled headers predate some
+// of them, so the tokens we use are defined here.
+/*---------------------------------------------------------------------------*/
+
+// GL_KHR_parallel_shader_compile, GL_ARB_parallel_shader_compile
+#ifndef GL_COMPLETION_STATUS_KHR
+#define GL_COMPLETION_STATUS_KHR 0x91B1
+#endif
+
+// GL_ARB_timer_query, GL_EXT_disjoint_timer_query
+#ifndef GL_TIME_ELAPSED_EXT
+#define GL_TIME_ELAPSED_EXT 0x88BF
+#endif
+#ifndef GL_GPU_DISJOINT_EXT
+#define GL_GPU_DISJOINT_EXT 0x8FBB
+#endif
+
+/*---------------------------------------------------------------------------*/
+
+// GL_KHR_debug
+#ifndef GL_DEBUG_OUTPUT
+#define GL_DEBUG_OUTPUT 0x92E0
+#endif
+#ifndef GL_DEBUG_OUTPUT_SYNCHRONOUS
+#define GL_DEBUG_OUTPUT_SYNCHRONOUS 0x8242
+#endif
+#ifndef GL_DEBUG_TYPE_ERROR
+#define GL_DEBUG_TYPE_ERROR 0x824C
+#endif
+
+/*---------------------------------------------------------------------------*/
+
+bool openglHasExtension(const Params& params, const char *name);
+bool openglHasParallelCompile(const Params& params);
+
+// OpenGL error policy, from params.glErrors. Set it once, then set up each
+// context from its own thread. Without GL_KHR_debug, GL_ERRORS_DEBUG falls
+// back to GL_ERRORS_DEFERRED for that context.
+void openglSetErrorPolicy(const Params& params);
+void openglInitErrors(const Params& params);
+
+// Forget pending errors, so that they are not blamed on the next job
+void openglClearErrors();
+
+/*---------------------------------------------------------------------------*/
+
+#endif
@@ -0,0 +1,446 @@
+#include <chrono>
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <errno.h>
+#include <string.h>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "output.h"
+#include "bench.h"
+#include "hash.h"
+#include "lodepng.h"
+#include "trace.h"
+
+using namespace std::chrono;
+
+/*---------------------------------------------------------------------------*/
+
+static const char RAW_MAGIC[4] = { 'G', 'I', 'R', 'W' };
+
+const char *outputExtension(OUTPUT_FORMAT format) {
+    switch (format) {
+    case OUTPUT_PNG:
+        return "png";
+    case OUTPUT_PPM:
+        return "ppm";
+    case OUTPUT_PAM:
+        return "pam";
+    case OUTPUT_RAW:
+    case OUTPUT_MMAP:
+        break;
+    }
+    return "raw";
+}
+
+/*---------------------------------------------------------------------------*/
+
+uint64_t outputRawSize(int width, int height) {
+    return sizeof(RawHeader) + (uint64_t) width * height * CHANNELS;
+}
+
+/*---------------------------------------------------------------------------*/
+
+static RawHeader rawHeader(const Params& params) {
+    RawHeader header;
+    memcpy(header.magic, RAW_MAGIC, sizeof(header.magic));
+    header.width = (uint32_t) params.width;
+    header.height = (uint32_t) params.height;
+    header.channels = CHANNELS;
+    header.flags = params.flip ? 0 : RAW_FLAG_BOTTOM_UP;
+    return header;
+}
+
+/*---------------------------------------------------------------------------*/
+// PNG
+/*---------------------------------------------------------------------------*/
+
+// Images are only compared to references, so the fast levels trade file
+// size for encoding speed. Colors are kept as RGBA rather than looking
+// for the smallest color type, which costs a pass over the pixels.
+
+static void setPNGLevel(lodepng::State& state, PNG_LEVEL level) {
+    if (level == PNG_LEVEL_DEFAULT) {
+        return;
+    }
+    state.encoder.auto_convert = 0;
+    LodePNGCompressSettings& zlib = state.encoder.zlibsettings;
+    if (level == PNG_LEVEL_STORE) {
+        // Filters only help compression
+        state.encoder.filter_strategy = LFS_ZERO;
+        zlib.btype = 0;
+        zlib.use_lz77 = 0;
+    } else {
+        // Filtering is cheap compared to a long lz77 search, and keeps
+        // smooth images small
+        zlib.windowsize = 512;
+        zlib.nicematch = 32;
+        zlib.lazymatching = 0;
+    }
+}
+
+/*---------------------------------------------------------------------------*/
+
+// Swap whole rows, so that no second image buffer is needed
+
+static void flipRows(std::vector<uint8_t>& data, int width, int height) {
+    size_t rowSize = (size_t) width * CHANNELS;
+    std::vector<uint8_t> row(rowSize);
+    uint8_t *top = data.data();
+    uint8_t *bottom = data.data() + (height - 1) * rowSize;
+    while (top < bottom) {
+        memcpy(row.data(), top, rowSize);
+        memcpy(top, bottom, rowSize);
+        memcpy(bottom, row.data(), rowSize);
+        top += rowSize;
+        bottom -= rowSize;
+    }
+}
+
+/*---------------------------------------------------------------------------*/
+
+static JobStatus writePNG(const Params& params, std::vector<uint8_t>& data) {
+    steady_clock::time_point timeStart;
+    if (params.profile) {
+        timeStart = steady_clock::now();
+    }
+    unsigned int uwidth = (unsigned int) params.width;
+    unsigned int uheight = (unsigned int) params.height;
+    {
+        BenchTimer timer(STAGE_FLIP);
+        TraceSpan span("flip");
+        flipRows(data, params.width, params.height);
+    }
+
+    lodepng::State state;
+    setPNGLevel(state, params.pngLevel);
+    std::vector<std::uint8_t> png;
+    unsigned png_error;
+    {
+        BenchTimer timer(STAGE_ENCODE);
+        TraceSpan span("lodepng::encode");
+        png_error = lodepng::encode(png, data, uwidth, uheight, state);
+    }
+    if (png_error) {
+        error_return("lodepng: %s", lodepng_error_text(png_error));
+    }
+    if (params.profile) {
+        printf("PNG encode time (us): %ld\n", duration_cast<microseconds>(steady_clock::now() - timeStart).count());
+    }
+    BenchTimer timer(STAGE_WRITE);
+    TraceSpan span("lodepng::save_file");
+    png_error = lodepng::save_file(png, params.output);
+    if (png_error) {
+        error_return("lodepng: %s: %s", params.output.c_str(), lodepng_error_text(png_error));
+    }
+    return EXIT_SUCCESS;
+}
+
+/*---------------------------------------------------------------------------*/
+// Uncompressed formats
+/*---------------------------------------------------------------------------*/
+
+// Write the rows of data top row first, unless bottomUp. No copy needed
+// either way.
+
+static void writeRows(std::ofstream& out, const Params& params, const std::vector<uint8_t>& data, bool bottomUp) {
+    size_t rowSize = (size_t) params.width * CHANNELS;
+    if (bottomUp) {
+        out.write((const char *) data.data(), rowSize * params.height);
+        return;
+    }
+    for (int h = params.height - 1; h >= 0; h--) {
+        out.write((const char *) &data[h * rowSize], rowSize);
+    }
+}
+
+/*---------------------------------------------------------------------------*/
+
+static JobStatus writeRaw(const Params& params, const std::vector<uint8_t>& data) {
+    std::ofstream out(params.output, std::ios::binary);
+    RawHeader header = rawHeader(params);
+    out.write((const char *) &header, sizeof(header));
+    writeRows(out, params, data, !params.flip);
+    out.close();
+    if (!out) {
+        error_return("Cannot write image to: %s", params.output.c_str());
+    }
+    return EXIT_SUCCESS;
+}
+
+/*---------------------------------------------------------------------------*/
+
+static JobStatus writePAM(const Params& params, const std::vector<uint8_t>& data) {
+    std::ofstream out(params.output, std::ios::binary);
+    out << "P7\nWIDTH " << params.width << "\nHEIGHT " << params.height
+        << "\nDEPTH 4\nMAXVAL 255\nTUPLTYPE RGB_ALPHA\nENDHDR\n";
+    writeRows(out, params, data, false);
+    out.close();
+    if (!out) {
+        error_return("Cannot write image to: %s", params.output.c_str());
+    }
+    return EXIT_SUCCESS;
+}
+
+/*---------------------------------------------------------------------------*/
+
+static JobStatus writePPM(const Params& params, const std::vector<uint8_t>& data) {
+    std::ofstream out(params.output, std::ios::binary);
+    out << "P6\n" << params.width << " " << params.height << "\n255\n";
+    std::vector<uint8_t> row((size_t) params.width * 3);
+    for (int h = params.height - 1; h >= 0; h--) {
+        const uint8_t *pixel = &data[(size_t) h * params.width * CHANNELS];
+        for (int w = 0; w < params.width; w++) {
+            row[w * 3] = pixel[0];
+            row[w * 3 + 1] = pixel[1];
+            row[w * 3 + 2] = pixel[2];
+            pixel += CHANNELS;
+        }
+        out.write((const char *) row.data(), row.size());
+    }
+    out.close();
+    if (!out) {
+        error_return("Cannot write image to: %s", params.output.c_str());
+    }
+    return EXIT_SUCCESS;
+}
+
+/*---------------------------------------------------------------------------*/
+// Memory mapped files
+/*---------------------------------------------------------------------------*/
+
+typedef struct {
+    uint8_t *data;
+    uint64_t size;
+} MappedFile;
+
+// Files stay mapped until outputTerminate(), so that a batch only opens
+// its output file once
+static std::mutex mappedMutex;
+static std::map<std::string, MappedFile> mappedFiles;
+
+#ifndef _WIN32
+
+static JobStatus mapFile(const std::string& filename, MappedFile& mapped) {
+    std::lock_guard<std::mutex> lock(mappedMutex);
+    std::map<std::string, MappedFile>::iterator it = mappedFiles.find(filename);
+    if (it != mappedFiles.end()) {
+        mapped = it->second;
+        return EXIT_SUCCESS;
+    }
+
+    int fd = open(filename.c_str(), O_RDWR);
+    if (fd < 0) {
+        error_return("Cannot open %s: %s", filename.c_str(), strerror(errno));
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size == 0) {
+        close(fd);
+        error_return("%s must be preallocated to the size of all images", filename.c_str());
+    }
+    void *data = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    // The mapping keeps the file open
+    close(fd);
+    if (data == MAP_FAILED) {
+        error_return("Cannot map %s: %s", filename.c_str(), strerror(errno));
+    }
+    mapped.data = (uint8_t *) data;
+    mapped.size = (uint64_t) st.st_size;
+    mappedFiles[filename] = mapped;
+    return EXIT_SUCCESS;
+}
+
+/*---------------------------------------------------------------------------*/
+
+static void unmapFile(MappedFile& mapped) {
+    munmap(mapped.data, mapped.size);
+}
+
+#else
+
+static JobStatus mapFile(const std::string& filename, MappedFile& mapped) {
+    error_return("mmap output is not supported on Windows");
+}
+
+static void unmapFile(MappedFile& mapped) {
+}
+
+#endif
+
+/*---------------------------------------------------------------------------*/
+
+static JobStatus writeMmap(const Params& params, const std::vector<uint8_t>& data) {
+    MappedFile mapped;
+    CHECK_STATUS(mapFile(params.output, mapped));
+    uint64_t size = outputRawSize(params.width, params.height);
+    if (params.outputOffset > mapped.size || size > mapped.size - params.outputOffset) {
+        error_return("Image at offset %llu does not fit in %s (%llu bytes)",
+                     (unsigned long long) params.outputOffset, params.output.c_str(),
+                     (unsigned long long) mapped.size);
+    }
+
+    uint8_t *out = mapped.data + params.outputOffset;
+    RawHeader header = rawHeader(params);
+    memcpy(out, &header, sizeof(header));
+    out += sizeof(header);
+    size_t rowSize = (size_t) params.width * CHANNELS;
+    if (!params.flip) {
+        memcpy(out, data.data(), rowSize * params.height);
+        return EXIT_SUCCESS;
+    }
+    for (int h = params.height - 1; h >= 0; h--) {
+        memcpy(out, &data[h * rowSize], rowSize);
+        out += rowSize;
+    }
+    return EXIT_SUCCESS;
+}
+
+/*---------------------------------------------------------------------------*/
+
+JobStatus writeImage(const Params& params, std::vector<uint8_t>& data) {
+    if (params.outputFormat == OUTPUT_PNG) {
+        return writePNG(params, data);
+    }
+    // The other formats flip rows as they write them
+    BenchTimer timer(STAGE_WRITE);
+    TraceSpan span("writeImage");
+    switch (params.outputFormat) {
+    case OUTPUT_PNG:
+        break;
+    case OUTPUT_RAW:
+        return writeRaw(params, data);
+    case OUTPUT_PPM:
+        return writePPM(params, data);
+    case OUTPUT_PAM:
+        return writePAM(params, data);
+    case OUTPUT_MMAP:
+        return writeMmap(params, data);
+    }
+    error_return("Invalid output format");
+}
+
+/*---------------------------------------------------------------------------*/
+// Reference checks
+/*---------------------------------------------------------------------------*/
+
+bool isReferenceHash(const std::string& s) {
+    return s.size() == 16 && s.find_first_not_of("0123456789abcdefABCDEF") == std::string::npos;
+}
+
+/*---------------------------------------------------------------------------*/
+
+static uint64_t hashImage(const Params& params, const std::vector<uint8_t>& data) {
+    size_t rowSize = (size_t) params.width * CHANNELS;
+    Hash64State state;
+    hash64Init(state);
+    for (int h = params.height - 1; h >= 0; h--) {
+        hash64Update(state, &data[h * rowSize], rowSize);
+    }
+    return hash64Final(state);
+}
+
+/*---------------------------------------------------------------------------*/
+
+static JobStatus compareImage(const Params& params, const std::vector<uint8_t>& data, ImageCheck& check) {
+    std::vector<uint8_t> reference;
+    unsigned int width, height;
+    unsigned png_error = lodepng::decode(reference, width, height, params.reference);
+    if (png_error) {
+        error_return("lodepng: %s: %s", params.reference.c_str(), lodepng_error_text(png_error));
+    }
+    if (width != (unsigned int) params.width || height != (unsigned int) params.height) {
+        printf("Warning: %s is %ux%u, image is %dx%d\n", params.reference.c_str(),
+               width, height, params.width, params.height);
+        check.maxDelta = 255;
+        check.diffPixels = (uint64_t) params.width * params.height;
+        return EXIT_SUCCESS;
+    }
+
+    size_t rowSize = (size_t) width * CHANNELS;
+    for (unsigned int h = 0; h < height; h++) {
+        const uint8_t *ref = &reference[h * rowSize];
+        const uint8_t *pixel = &data[(height - h - 1) * rowSize];
+        for (unsigned int w = 0; w < width; w++) {
+            int delta = 0;
+            for (int c = 0; c < CHANNELS; c++) {
+                int d = abs((int) pixel[c] - (int) ref[c]);
+                if (d > delta) {
+                    delta = d;
+                }
+            }
+            if (delta > 0) {
+                check.diffPixels++;
+                if (delta > check.maxDelta) {
+                    check.maxDelta = delta;
+                }
+            }
+            pixel += CHANNELS;
+            ref += CHANNELS;
+        }
+    }
+    return EXIT_SUCCESS;
+}
+
+/*---------------------------------------------------------------------------*/
+
+JobStatus checkImage(const Params& params, const std::vector<uint8_t>& data, ImageCheck& check) {
+    TraceSpan span("checkImage");
+    check.hashed = false;
+    check.hash = 0;
+    check.compared = false;
+    check.match = false;
+    check.pixelDiff = false;
+    check.maxDelta = 0;
+    check.diffPixels = 0;
+
+    bool referenceHash = isReferenceHash(params.reference);
+    if (params.hashImage || referenceHash) {
+        check.hash = hashImage(params, data);
+        check.hashed = true;
+    }
+    if (params.reference == "") {
+        return EXIT_SUCCESS;
+    }
+    if (referenceHash) {
+        check.match = (strtoull(params.reference.c_str(), NULL, 16) == check.hash);
+    } else {
+        CHECK_STATUS(compareImage(params, data, check));
+        check.pixelDiff = true;
+        check.match = (check.maxDelta <= params.tolerance);
+    }
+    check.compared = true;
+    return EXIT_SUCCESS;
+}
+
+/*---------------------------------------------------------------------------*/
+
+JobStatus outputImage(const Params& params, std::vector<uint8_t>& data, ImageCheck& check) {
+    CHECK_STATUS(checkImage(params, data, check));
+    if (check.compared && check.match) {
+        return EXIT_SUCCESS;
+    }
+    CHECK_STATUS(writeImage(params, data));
+    if (check.compared) {
+        errcode_return(MISMATCH_EXIT_CODE, "Image differs from reference: %s", params.reference.c_str());
+    }
+    return EXIT_SUCCESS;
+}
+
+/*---------------------------------------------------------------------------*/
+
+void outputTerminate() {
+    std::lock_guard<std::mutex> lock(mappedMutex);
+    std::map<std::string, MappedFile>::iterator it;
+    for (it = mappedFiles.begin(); it != mappedFiles.end(); ++it) {
+        unmapFile(it->second);
+    }
+    mappedFiles.clear();
+}
+
+/*---------------------------------------------------------------------------*/
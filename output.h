@@ -0,0 +1,65 @@
+#ifndef __GETIMAGE_OUTPUT__
+#define __GETIMAGE_OUTPUT__
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include "common.h"
+
+/*---------------------------------------------------------------------------*/
+// Image files. Pixels always come in OpenGL order, i.e. bottom row first,
+// and are RGBA.
+/*---------------------------------------------------------------------------*/
+
+// Raw images: this header, then height rows of width * channels bytes
+typedef struct {
+    char magic[4];      // "GIRW"
+    uint32_t width;
+    uint32_t height;
+    uint32_t channels;
+    uint32_t flags;
+} RawHeader;
+
+// Rows are in OpenGL order, bottom row first
+#define RAW_FLAG_BOTTOM_UP (1)
+
+// File name extension for the format, without the dot
+const char *outputExtension(OUTPUT_FORMAT format);
+
+// Size of one image in a raw or mmap file, header included
+uint64_t outputRawSize(int width, int height);
+
+// Write params.output in params.outputFormat. Safe to call from several
+// threads, including for images of the same mmap file. PNG images are
+// flipped in place: data is left top-down.
+JobStatus writeImage(const Params& params, std::vector<uint8_t>& data);
+
+// Result of checkImage()
+typedef struct {
+    bool hashed;
+    uint64_t hash;          // Of the top-down RGBA pixels
+    bool compared;
+    bool match;
+    bool pixelDiff;         // Compared to a reference image, not a hash
+    int maxDelta;           // Largest channel difference with a reference image
+    uint64_t diffPixels;    // Number of pixels with any channel difference
+} ImageCheck;
+
+// Whether a reference is a hash (16 hexadecimal digits) rather than a file
+bool isReferenceHash(const std::string& reference);
+
+// Hash the image if params.hashImage, and compare it to params.reference,
+// either a hash (16 hexadecimal digits) or a PNG image. Images match if no
+// channel differs by more than params.tolerance.
+JobStatus checkImage(const Params& params, const std::vector<uint8_t>& data, ImageCheck& check);
+
+// Check the image, then write it unless it matches the reference
+JobStatus outputImage(const Params& params, std::vector<uint8_t>& data, ImageCheck& check);
+
+// Unmap the mmap files, once all images are written
+void outputTerminate();
+
+/*---------------------------------------------------------------------------*/
+
+#endif
@@ -0,0 +1,143 @@
+#include <atomic>
+#include <fstream>
+#include <vector>
+#include <stdio.h>
+#include <string.h>
+
+#include "progcache.h"
+#include "filemap.h"
+#include "hash.h"
+#include "openglext.h"
+
+/*---------------------------------------------------------------------------*/
+
+static std::atomic<int> cacheHits(0);
+static std::atomic<int> cacheMisses(0);
+static std::atomic<int> cacheRejected(0);
+
+// Cache file layout: this header, then the binary itself
+typedef struct {
+    char magic[4];
+    uint32_t format;
+    uint32_t length;
+} CacheHeader;
+
+static const char CACHE_MAGIC[4] = { 'G', 'I', 'P', 'B' };
+
+/*---------------------------------------------------------------------------*/
+
+static std::string cacheFilename(const Params& params) {
+    return params.programCache + "/" + params.programCacheKey + ".bin";
+}
+
+/*---------------------------------------------------------------------------*/
+
+static uint64_t hashGLString(GLenum name, uint64_t seed) {
+    const char *s = (const char *) glGetString(name);
+    return hash64(s != NULL ? s : "", s != NULL ? strlen(s) : 0, seed);
+}
+
+/*---------------------------------------------------------------------------*/
+
+std::string programCacheKey(const Params& params, const FileContents& vertContents, const FileContents& fragContents) {
+    int supported = ((params.API == API_OPENGL && params.APIVersion >= 410) ||
+                     (params.API == API_OPENGL_ES && params.APIVersion >= 300));
+    if (!supported) {
+        return "";
+    }
+    GLint numFormats = 0;
+    glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &numFormats);
+    if (numFormats <= 0) {
+        return "";
+    }
+    std::vector<GLint> formats((size_t) numFormats);
+    glGetIntegerv(GL_PROGRAM_BINARY_FORMATS, formats.data());
+
+    uint64_t h = hash64(vertContents.data(), vertContents.size());
+    h = hash64(fragContents.data(), fragContents.size(), h);
+    h = hashGLString(GL_VENDOR, h);
+    h = hashGLString(GL_RENDERER, h);
+    h = hashGLString(GL_VERSION, h);
+    h = hash64(formats.data(), formats.size() * sizeof(GLint), h);
+    return hashToString(h);
+}
+
+/*---------------------------------------------------------------------------*/
+
+bool programCacheLoad(Params& params) {
+    std::ifstream ifs(cacheFilename(params).c_str(), std::ios::binary | std::ios::ate);
+    std::streamoff fileSize = ifs ? (std::streamoff) ifs.tellg() : 0;
+    ifs.seekg(0);
+    CacheHeader header;
+    if (!ifs.read((char *) &header, sizeof(header))
+        || memcmp(header.magic, CACHE_MAGIC, sizeof(CACHE_MAGIC)) != 0
+        || fileSize != (std::streamoff) (sizeof(header) + header.length)) {
+        cacheMisses++;
+        return false;
+    }
+    std::vector<char> binary(header.length);
+    if (!ifs.read(binary.data(), header.length)) {
+        cacheMisses++;
+        return false;
+    }
+
+    GLuint program = glCreateProgram();
+    glProgramParameteri(program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+    glProgramBinary(program, (GLenum) header.format, binary.data(), (GLsizei) header.length);
+    GLint status = 0;
+    glGetProgramiv(program, GL_LINK_STATUS, &status);
+    // An unknown format is reported as an error: don't blame the job for
+    // it, nor leave it to the debug callback
+    bool failed = (glGetError() != GL_NO_ERROR);
+    if (failed || !status) {
+        openglClearErrors();
+        glDeleteProgram(program);
+        cacheRejected++;
+        cacheMisses++;
+        return false;
+    }
+
+    params.program = program;
+    params.programCached = true;
+    cacheHits++;
+    return true;
+}
+
+/*---------------------------------------------------------------------------*/
+
+void programCacheStore(const Params& params) {
+    GLint length = 0;
+    glGetProgramiv(params.program, GL_PROGRAM_BINARY_LENGTH, &length);
+    if (length <= 0) {
+        return;
+    }
+    // The entry is the header followed by the binary
+    std::string entry(sizeof(CacheHeader) + (size_t) length, '\0');
+    GLenum format;
+    glGetProgramBinary(params.program, length, NULL, &format, &entry[sizeof(CacheHeader)]);
+    if (glGetError() != GL_NO_ERROR) {
+        openglClearErrors();
+        printf("Warning: cannot retrieve program binary for the cache\n");
+        return;
+    }
+
+    CacheHeader header;
+    memcpy(header.magic, CACHE_MAGIC, sizeof(CACHE_MAGIC));
+    header.format = (uint32_t) format;
+    header.length = (uint32_t) length;
+    memcpy(&entry[0], &header, sizeof(header));
+
+    std::string filename = cacheFilename(params);
+    if (!writeFileAtomic(filename, entry)) {
+        printf("Warning: cannot write program cache entry: %s\n", filename.c_str());
+    }
+}
+
+/*---------------------------------------------------------------------------*/
+
+void programCachePrintStats() {
+    printf("program cache: %d hits, %d misses (%d rejected binaries)\n",
+           cacheHits.load(), cacheMisses.load(), cacheRejected.load());
+}
+
+/*---------------------------------------------------------------------------*/
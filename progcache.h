@@ -0,0 +1,31 @@
+#ifndef __GETIMAGE_PROGCACHE__
+#define __GETIMAGE_PROGCACHE__
+
+#include <string>
+
+#include "filemap.h"
+#include "openglcontext.h"
+
+/*---------------------------------------------------------------------------*/
+// On-disk cache of program binaries, in the params.programCache directory.
+// Entries are keyed by the shader sources and the driver identity, so a
+// driver update simply misses.
+/*---------------------------------------------------------------------------*/
+
+// Returns "" if the context cannot use program binaries.
+std::string programCacheKey(const Params& params, const FileContents& vertContents, const FileContents& fragContents);
+
+// Create params.program from the binary cached under
+// params.programCacheKey. Returns false on a miss, including binaries
+// rejected by the driver, in which case the shaders must be compiled.
+bool programCacheLoad(Params& params);
+
+// Save the binary of the linked params.program. Failures are only warned
+// about: the cache is an optimisation.
+void programCacheStore(const Params& params);
+
+void programCachePrintStats();
+
+/*---------------------------------------------------------------------------*/
+
+#endif
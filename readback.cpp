@@ -0,0 +1,120 @@
+#include <string.h>
+
+#include "readback.h"
+#include "trace.h"
+
+/*---------------------------------------------------------------------------*/
+
+bool readbackSupported(const Params& params) {
+    return ((params.API == API_OPENGL && params.APIVersion >= 320) ||
+            (params.API == API_OPENGL_ES && params.APIVersion >= 300));
+}
+
+/*---------------------------------------------------------------------------*/
+
+JobStatus readbackInit(ReadbackRing& ring, size_t numSlots) {
+    ring.slots.resize(numSlots);
+    ring.next = 0;
+    ring.busy = 0;
+    for (size_t i = 0; i < numSlots; i++) {
+        ReadbackSlot& slot = ring.slots[i];
+        GL_SAFECALL(glGenBuffers, 1, &slot.pbo);
+        slot.fence = 0;
+        slot.size = 0;
+        slot.width = 0;
+        slot.height = 0;
+    }
+    GL_CHECKSTAGE("readback setup");
+    return EXIT_SUCCESS;
+}
+
+/*---------------------------------------------------------------------------*/
+
+bool readbackFull(const ReadbackRing& ring) {
+    return ring.busy == ring.slots.size();
+}
+
+/*---------------------------------------------------------------------------*/
+
+JobStatus readbackStart(ReadbackRing& ring, const Params& params, size_t& slotIndex) {
+    if (readbackFull(ring)) {
+        error_return("all readback buffers are in use");
+    }
+    slotIndex = ring.next;
+    ReadbackSlot& slot = ring.slots[slotIndex];
+    size_t size = (size_t) params.width * params.height * CHANNELS;
+
+    GL_SAFECALL(glBindBuffer, GL_PIXEL_PACK_BUFFER, slot.pbo);
+    if (slot.size != size) {
+        GL_SAFECALL(glBufferData, GL_PIXEL_PACK_BUFFER, size, NULL, GL_STREAM_READ);
+        slot.size = size;
+    }
+    // With a pack buffer bound, the last argument is an offset in it
+    TraceSpan span("glReadPixels");
+    glReadPixels(0, 0, params.width, params.height, GL_RGBA, GL_UNSIGNED_BYTE, 0);
+    GLenum err = glGetError();
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    if (err != GL_NO_ERROR) {
+        error_return("OpenGL error: glReadPixels(): %s", openglErrorString(err));
+    }
+
+    slot.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    GL_CHECKERR("glFenceSync");
+    // Make sure the fence reaches the GPU, else waiting on it may hang
+    GL_SAFECALL(glFlush);
+    slot.width = params.width;
+    slot.height = params.height;
+
+    ring.next = (ring.next + 1) % ring.slots.size();
+    ring.busy++;
+    return EXIT_SUCCESS;
+}
+
+/*---------------------------------------------------------------------------*/
+
+JobStatus readbackFinish(ReadbackRing& ring, size_t slotIndex, std::vector<uint8_t>& data) {
+    ReadbackSlot& slot = ring.slots[slotIndex];
+    ring.busy--;
+
+    GLenum waitStatus;
+    TraceSpan span("glClientWaitSync");
+    do {
+        // One second at a time
+        waitStatus = glClientWaitSync(slot.fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000);
+    } while (waitStatus == GL_TIMEOUT_EXPIRED);
+    span.end();
+    glDeleteSync(slot.fence);
+    slot.fence = 0;
+    if (waitStatus == GL_WAIT_FAILED) {
+        error_return("glClientWaitSync failed");
+    }
+
+    size_t size = (size_t) slot.width * slot.height * CHANNELS;
+    GL_SAFECALL(glBindBuffer, GL_PIXEL_PACK_BUFFER, slot.pbo);
+    void *pixels = glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, size, GL_MAP_READ_BIT);
+    if (pixels == NULL) {
+        GLenum err = glGetError();
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+        error_return("OpenGL error: glMapBufferRange(): %s", openglErrorString(err));
+    }
+    data.resize(size);
+    memcpy(data.data(), pixels, size);
+    glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+    GL_SAFECALL(glBindBuffer, GL_PIXEL_PACK_BUFFER, 0);
+    return EXIT_SUCCESS;
+}
+
+/*---------------------------------------------------------------------------*/
+
+void readbackTerminate(ReadbackRing& ring) {
+    for (size_t i = 0; i < ring.slots.size(); i++) {
+        if (ring.slots[i].fence != 0) {
+            glDeleteSync(ring.slots[i].fence);
+        }
+        glDeleteBuffers(1, &ring.slots[i].pbo);
+    }
+    ring.slots.clear();
+    ring.busy = 0;
+}
+
+/*---------------------------------------------------------------------------*/
@@ -0,0 +1,49 @@
+#ifndef __GETIMAGE_READBACK__
+#define __GETIMAGE_READBACK__
+
+#include <stdint.h>
+#include <vector>
+
+#include "openglcontext.h"
+
+/*---------------------------------------------------------------------------*/
+// Asynchronous framebuffer readback through a ring of pixel pack buffers.
+// readbackStart() only queues the copy into a buffer, followed by a fence;
+// readbackFinish() waits for that fence and maps the buffer, by which time
+// the GPU is hopefully done and the call does not stall.
+/*---------------------------------------------------------------------------*/
+
+typedef struct {
+    GLuint pbo;
+    GLsync fence;
+    size_t size;  // Allocated size of pbo, in bytes
+    int width;
+    int height;
+} ReadbackSlot;
+
+typedef struct {
+    std::vector<ReadbackSlot> slots;
+    size_t next;   // Slot used by the next readbackStart()
+    size_t busy;   // Number of started, not yet finished slots
+} ReadbackRing;
+
+/*---------------------------------------------------------------------------*/
+
+// Pixel buffers and fences need OpenGL >= 3.2 or OpenGLES >= 3.0
+bool readbackSupported(const Params& params);
+
+JobStatus readbackInit(ReadbackRing& ring, size_t numSlots);
+bool readbackFull(const ReadbackRing& ring);
+
+// Start reading the params.width x params.height framebuffer. Slots are
+// used, and must be finished, in order: slot tells which one it was.
+JobStatus readbackStart(ReadbackRing& ring, const Params& params, size_t& slot);
+
+// Get the pixels of the oldest started slot, in OpenGL (bottom-up) order.
+JobStatus readbackFinish(ReadbackRing& ring, size_t slot, std::vector<uint8_t>& data);
+
+void readbackTerminate(ReadbackRing& ring);
+
+/*---------------------------------------------------------------------------*/
+
+#endif
@@ -0,0 +1,69 @@
+#!/bin/sh
+# Render checks that need an OpenGL context: tiled and atlas renders must
+# give the same images as plain ones. Usage: render_tests.sh path/to/get_image_xxx
+# Run from a scratch directory: the shaders are written to the current one.
+# Exits with 77, which ctest reports as skipped, if nothing can be rendered.
+
+BIN="$1"
+failures=0
+
+# Prints the hash of the image, or of each variant, nothing if the render
+# failed
+hashOf() {
+    "$BIN" "$@" --fbo rgba8 --resolution 64 48 --hash | sed -n 's/.*"hash":"\([0-9a-f]*\)".*/\1/p'
+}
+
+check() {
+    if [ -z "$2" ] || [ "$2" != "$3" ]; then
+        echo "FAILED: $1: got '$2', expected '$3'"
+        failures=$((failures + 1))
+    fi
+}
+
+# Uses gl_FragCoord, so tiles and atlases need _GLF_tileOffset, and the
+# uniforms of its JSON file, the variants only changing one of them
+cat > coord.frag <<'END'
+#version 300 es
+precision highp float;
+uniform float time;
+uniform vec2 mouse;
+out vec4 color;
+void main() {
+    color = vec4(fract(time), gl_FragCoord.x / 64.0, gl_FragCoord.y / 48.0, mouse.x);
+}
+END
+cat > coord.json <<'END'
+{
+  "time": { "func": "glUniform1f", "args": [ 0.25 ] },
+  "mouse": { "func": "glUniform2f", "args": [ 0.5, 0.0 ] }
+}
+END
+cat > coord.jsonl <<'END'
+{ "mouse": { "func": "glUniform2f", "args": [ 0.25, 0.0 ] } }
+{ "mouse": { "func": "glUniform2f", "args": [ 0.75, 0.0 ] } }
+{ "mouse": { "func": "glUniform2f", "args": [ 1.0, 0.0 ] } }
+END
+cp coord.frag defaults.frag
+# _GLF_tileOffset must be declared after #version, past the block comments
+{ printf '/* Block comment,\n   over two lines */\n'; cat coord.frag; } > comment.frag
+cp coord.json comment.json
+
+plain=$(hashOf coord.frag)
+if [ -z "$plain" ]; then
+    echo "Cannot render, skipping"
+    exit 77
+fi
+
+check "tiled with a JSON file" "$(hashOf coord.frag --tile-size 16)" "$plain"
+check "tiled after a block comment" "$(hashOf comment.frag --tile-size 16)" "$plain"
+check "tiled with the defaults" "$(hashOf defaults.frag --tile-size 16)" "$(hashOf defaults.frag)"
+
+variants=$(hashOf coord.frag --variants coord.jsonl)
+check "atlas with a JSON file" "$(hashOf coord.frag --variants coord.jsonl --atlas)" "$variants"
+check "atlas with the defaults" "$(hashOf defaults.frag --variants coord.jsonl --atlas)" "$(hashOf defaults.frag --variants coord.jsonl)"
+
+if [ $failures -gt 0 ]; then
+    echo "$failures checks failed"
+    exit 1
+fi
+echo "All checks passed"
@@ -0,0 +1,328 @@
+#include <algorithm>
+#include <fstream>
+#include <string>
+#include <thread>
+#include <vector>
+#include <stdio.h>
+
+#include "common.h"
+#include "filemap.h"
+#include "gputimes.h"
+#include "hash.h"
+#include "memo.h"
+#include "uniformfile.h"
+#include "workqueue.h"
+
+/*---------------------------------------------------------------------------*/
+// Unit tests of the parts that do not need an OpenGL context. Run from a
+// scratch directory: they write their input files to the current one.
+/*---------------------------------------------------------------------------*/
+
+static int failures = 0;
+
+#define CHECK(cond) do {                                                \
+        if (!(cond)) {                                                  \
+            printf("%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+            failures++;                                                 \
+        }                                                               \
+    } while (0)
+
+static void writeFile(const char *filename, const std::string& contents) {
+    std::ofstream ofs(filename);
+    ofs << contents;
+}
+
+/*---------------------------------------------------------------------------*/
+// Hashing
+/*---------------------------------------------------------------------------*/
+
+static void testHash() {
+    // Reference values of XXH64
+    CHECK(hash64("") == 0xef46db3751d8e999ULL);
+    CHECK(hash64("a") == 0xd24ec4f1a98c6e5bULL);
+    CHECK(hash64("abc") == 0x44bc2cf5ad770999ULL);
+    CHECK(hashToString(0xef46db3751d8e999ULL) == "ef46db3751d8e999");
+    CHECK(hashToString(1) == "0000000000000001");
+
+    // Long enough for the 32-byte stripes
+    std::string data;
+    for (int i = 0; i < 1000; i++) {
+        data += (char) (i * 7);
+    }
+    CHECK(hash64(data, 0) != hash64(data, 1));
+    CHECK(hash64(data.substr(0, 999)) != hash64(data));
+
+    // Same hash from pieces of all sizes, across the stripes
+    for (uint64_t seed = 0; seed < 2; seed++) {
+        uint64_t expected = hash64(data, seed);
+        for (size_t piece = 1; piece < 70; piece++) {
+            Hash64State state;
+            hash64Init(state, seed);
+            for (size_t i = 0; i < data.size(); i += piece) {
+                hash64Update(state, data.data() + i, std::min(piece, data.size() - i));
+            }
+            CHECK(hash64Final(state) == expected);
+        }
+    }
+}
+
+/*---------------------------------------------------------------------------*/
+// Memo normalization
+/*---------------------------------------------------------------------------*/
+
+static std::string normalize(const std::string& source) {
+    std::string out;
+    memoNormalize(source.data(), source.size(), out);
+    return out;
+}
+
+static void testMemoNormalize() {
+    CHECK(normalize("a  +  b") == "a+b");
+    CHECK(normalize("float   x = 1.0 ;") == "float x=1.0;");
+    CHECK(normalize("\n\n   #version 300 es\n\n") == "#version 300 es");
+    CHECK(normalize("int x; // comment\nint y;") == "int x;\nint y;");
+    CHECK(normalize("int/* comment */x;") == "int x;");
+    CHECK(normalize("#define A /* one\ntwo */ 1\nA") == "#define A 1\nA");
+    CHECK(normalize("x\r\n\ty") == "x\ny");
+
+    // Whitespace that separates tokens must stay
+    CHECK(normalize("a - -b") == "a- -b");
+    CHECK(normalize("a--b") == "a--b");
+    CHECK(normalize("a .5") == "a .5");
+    CHECK(normalize("a - -b") != normalize("a--b"));
+    CHECK(normalize("a + +b") != normalize("a++b"));
+
+    // Unterminated comments are dropped rather than read past the end
+    CHECK(normalize("x /* y") == "x");
+    CHECK(normalize("x // y") == "x");
+}
+
+/*---------------------------------------------------------------------------*/
+// Uniform files
+/*---------------------------------------------------------------------------*/
+
+static void testUniformFile() {
+    writeFile("unit_uniforms.json",
+        "{\n"
+        "  \"time\": { \"func\": \"glUniform1f\", \"args\": [ 1.5 ] },\n"
+        "  \"resolution\": { \"func\": \"glUniform2f\", \"args\": [ 256, 128 ], \"other\": { \"x\": 1 } },\n"
+        "  \"bad\": { \"func\": \"glUniform2i\", \"args\": [ 1, \"two\" ] },\n"
+        "  \"noargs\": { \"func\": 3 },\n"
+        "  \"twice\": { \"func\": 1, \"args\": [ 1, \"x\" ], \"func\": \"glUniform1i\", \"args\": [ 4 ] },\n"
+        "  \"time\": { \"func\": \"glUniform1f\", \"args\": [ 2.5 ] }\n"
+        "}\n");
+
+    std::shared_ptr<const UniformSet> uniforms;
+    CHECK(uniformFileLoad("unit_uniforms.json", uniforms) == EXIT_SUCCESS);
+    CHECK(uniforms != NULL && uniforms->size() == 5);
+    if (uniforms == NULL || uniforms->size() != 5) {
+        return;
+    }
+
+    // The last of duplicate entries wins
+    const UniformEntry& time = uniforms->at("time");
+    CHECK(time.hasFunc && time.funcIsString && time.func == "glUniform1f");
+    CHECK(time.hasArgs && time.argsIsArray && time.argsError == "");
+    CHECK(time.args == std::vector<double>({ 2.5 }));
+
+    const UniformEntry& resolution = uniforms->at("resolution");
+    CHECK(resolution.func == "glUniform2f");
+    CHECK(resolution.args == std::vector<double>({ 256, 128 }));
+
+    const UniformEntry& bad = uniforms->at("bad");
+    CHECK(bad.argsError == "type must be number, but is string");
+    CHECK(bad.badArg == 1);
+
+    const UniformEntry& noargs = uniforms->at("noargs");
+    CHECK(noargs.hasFunc && !noargs.funcIsString && !noargs.hasArgs);
+
+    // And so do duplicate fields
+    const UniformEntry& twice = uniforms->at("twice");
+    CHECK(twice.funcIsString && twice.func == "glUniform1i");
+    CHECK(twice.argsError == "" && twice.args == std::vector<double>({ 4 }));
+
+    // Cached until the file changes
+    std::shared_ptr<const UniformSet> again;
+    CHECK(uniformFileLoad("unit_uniforms.json", again) == EXIT_SUCCESS);
+    CHECK(again == uniforms);
+    writeFile("unit_uniforms.json", "{ \"time\": { \"func\": \"glUniform1f\", \"args\": [ 3 ] } }\n");
+    CHECK(uniformFileLoad("unit_uniforms.json", again) == EXIT_SUCCESS);
+    CHECK(again != uniforms && again->size() == 1);
+
+    writeFile("unit_malformed.json", "{ \"time\": ");
+    CHECK(uniformFileLoad("unit_malformed.json", again) != EXIT_SUCCESS);
+    writeFile("unit_malformed.json", "[ 1, 2 ]");
+    CHECK(uniformFileLoad("unit_malformed.json", again) != EXIT_SUCCESS);
+    CHECK(uniformFileLoad("unit_missing.json", again) != EXIT_SUCCESS);
+
+    remove("unit_uniforms.json");
+    remove("unit_malformed.json");
+}
+
+static void testUniformVariants() {
+    writeFile("unit_variants.jsonl",
+        "{ \"time\": { \"func\": \"glUniform1f\", \"args\": [ 0 ] } }\n"
+        "\n"
+        "  \r\n"
+        "{ \"time\": { \"func\": \"glUniform1f\", \"args\": [ 1 ] } }");
+
+    std::vector<UniformSet> variants;
+    CHECK(uniformVariantsLoad("unit_variants.jsonl", variants) == EXIT_SUCCESS);
+    CHECK(variants.size() == 2);
+    if (variants.size() == 2) {
+        CHECK(variants[0].at("time").args == std::vector<double>({ 0 }));
+        CHECK(variants[1].at("time").args == std::vector<double>({ 1 }));
+    }
+
+    writeFile("unit_variants.jsonl", "{}\n{ \"time\": \n");
+    CHECK(uniformVariantsLoad("unit_variants.jsonl", variants) != EXIT_SUCCESS);
+    writeFile("unit_variants.jsonl", "\n\n");
+    CHECK(uniformVariantsLoad("unit_variants.jsonl", variants) != EXIT_SUCCESS);
+
+    remove("unit_variants.jsonl");
+}
+
+/*---------------------------------------------------------------------------*/
+// Files
+/*---------------------------------------------------------------------------*/
+
+static void testFileContents() {
+    FileContents contents;
+    writeFile("unit_contents.txt", "contents");
+    CHECK(contents.load("unit_contents.txt") == EXIT_SUCCESS);
+    CHECK(contents.size() == 8 && contents.str() == "contents");
+
+    // Empty files cannot be mapped
+    writeFile("unit_contents.txt", "");
+    CHECK(contents.load("unit_contents.txt") == EXIT_SUCCESS);
+    CHECK(contents.size() == 0);
+
+    contents.assign(std::string("edited"));
+    CHECK(contents.str() == "edited");
+    CHECK(contents.load("unit_missing.txt") != EXIT_SUCCESS);
+    remove("unit_contents.txt");
+}
+
+static void testWriteFileAtomic() {
+    FileContents contents;
+    CHECK(writeFileAtomic("unit_atomic.bin", std::string("first\0", 6)));
+    CHECK(contents.load("unit_atomic.bin") == EXIT_SUCCESS);
+    CHECK(contents.str() == std::string("first\0", 6));
+    CHECK(writeFileAtomic("unit_atomic.bin", "second"));
+    CHECK(contents.load("unit_atomic.bin") == EXIT_SUCCESS);
+    CHECK(contents.str() == "second");
+    CHECK(!writeFileAtomic("unit_missing_dir/unit_atomic.bin", "third"));
+    remove("unit_atomic.bin");
+}
+
+/*---------------------------------------------------------------------------*/
+// GPU times
+/*---------------------------------------------------------------------------*/
+
+static void testGpuTimesCompute() {
+    std::vector<double> samples;
+    for (int i = 20; i >= 1; i--) {
+        samples.push_back(i);
+    }
+    GpuTimes times;
+    gpuTimesCompute(samples, times);
+    CHECK(times.count == 20 && times.min == 1 && times.max == 20);
+    CHECK(times.median == 10 && times.p95 == 19);
+
+    samples.assign(1, 7.5);
+    gpuTimesCompute(samples, times);
+    CHECK(times.count == 1 && times.min == 7.5 && times.median == 7.5);
+    CHECK(times.p95 == 7.5 && times.max == 7.5);
+
+    samples.clear();
+    gpuTimesCompute(samples, times);
+    CHECK(times.count == 0);
+}
+
+typedef struct {
+    int runs;
+    int disjointRuns;   // The first ones are disjoint
+    JobStatus status;
+} FakeRuns;
+
+// Samples of run i are all i
+static JobStatus fakeRun(void *data, std::vector<double>& samples, bool& disjoint) {
+    FakeRuns *fake = (FakeRuns *) data;
+    fake->runs++;
+    samples.assign(3, (double) fake->runs);
+    disjoint = fake->runs <= fake->disjointRuns;
+    return fake->status;
+}
+
+static void testGpuTimesMeasure() {
+    GpuTimes times;
+    FakeRuns fake = { 0, 0, EXIT_SUCCESS };
+    CHECK(gpuTimesMeasure(fakeRun, &fake, 3, times) == EXIT_SUCCESS);
+    CHECK(fake.runs == 1 && times.count == 3 && times.median == 1);
+
+    // Only the samples of the run that is not disjoint count
+    fake.runs = 0;
+    fake.disjointRuns = 2;
+    CHECK(gpuTimesMeasure(fakeRun, &fake, 3, times) == EXIT_SUCCESS);
+    CHECK(fake.runs == 3 && times.count == 3 && times.min == 3 && times.max == 3);
+
+    fake.runs = 0;
+    fake.disjointRuns = 3;
+    CHECK(gpuTimesMeasure(fakeRun, &fake, 3, times) != EXIT_SUCCESS);
+    CHECK(fake.runs == 3 && times.count == 0);
+
+    // Failed runs are not retried
+    fake.runs = 0;
+    fake.disjointRuns = 3;
+    fake.status = EXIT_FAILURE;
+    CHECK(gpuTimesMeasure(fakeRun, &fake, 3, times) == EXIT_FAILURE);
+    CHECK(fake.runs == 1 && times.count == 0);
+}
+
+/*---------------------------------------------------------------------------*/
+// Work queue
+/*---------------------------------------------------------------------------*/
+
+static void testWorkQueue() {
+    WorkQueue<int> queue(2);
+    int item;
+    CHECK(!queue.tryPop(item));
+
+    // The producer is held back by the bound, but all items come out in order
+    std::thread producer([&queue] {
+        for (int i = 0; i < 100; i++) {
+            queue.push(i);
+        }
+        queue.close();
+    });
+    int expected = 0;
+    while (queue.pop(item)) {
+        CHECK(item == expected);
+        expected++;
+    }
+    producer.join();
+    CHECK(expected == 100);
+    CHECK(!queue.pop(item));
+}
+
+/*---------------------------------------------------------------------------*/
+
+int main() {
+    testHash();
+    testMemoNormalize();
+    testUniformFile();
+    testUniformVariants();
+    testFileContents();
+    testWriteFileAtomic();
+    testGpuTimesCompute();
+    testGpuTimesMeasure();
+    testWorkQueue();
+    if (failures > 0) {
+        printf("%d checks failed\n", failures);
+        return EXIT_FAILURE;
+    }
+    printf("All checks passed\n");
+    return EXIT_SUCCESS;
+}
+
+/*---------------------------------------------------------------------------*/
@@ -0,0 +1,133 @@
+#include <fstream>
+#include <mutex>
+#include <vector>
+
+#include "trace.h"
+#include "json.hpp"
+
+using namespace std::chrono;
+using json = nlohmann::json;
+
+/*---------------------------------------------------------------------------*/
+
+typedef struct {
+    const char *name;
+    int64_t start;      // In nanoseconds since traceEnable()
+    int64_t duration;
+} TraceEvent;
+
+typedef struct {
+    int tid;
+    std::string name;
+    std::vector<TraceEvent> events;
+    size_t next;        // Where the next event goes
+    bool wrapped;       // Whether the oldest events were overwritten
+} TraceBuffer;
+
+bool traceOn = false;
+static steady_clock::time_point traceStart;
+
+// Buffers outlive their thread, so that they can be written at the end.
+// Each one is only written to by its thread, without locking.
+static std::mutex buffersMutex;
+static std::vector<TraceBuffer *> buffers;
+static thread_local TraceBuffer *threadBuffer = NULL;
+
+/*---------------------------------------------------------------------------*/
+
+void traceEnable() {
+    traceStart = steady_clock::now();
+    traceOn = true;
+}
+
+/*---------------------------------------------------------------------------*/
+
+static TraceBuffer *getBuffer() {
+    if (threadBuffer == NULL) {
+        TraceBuffer *buffer = new TraceBuffer;
+        buffer->events.resize(TRACE_RING_SIZE);
+        buffer->next = 0;
+        buffer->wrapped = false;
+        std::lock_guard<std::mutex> lock(buffersMutex);
+        buffer->tid = (int) buffers.size() + 1;
+        buffers.push_back(buffer);
+        threadBuffer = buffer;
+    }
+    return threadBuffer;
+}
+
+/*---------------------------------------------------------------------------*/
+
+void traceThreadName(const std::string& name) {
+    if (!traceOn) {
+        return;
+    }
+    TraceBuffer *buffer = getBuffer();
+    std::lock_guard<std::mutex> lock(buffersMutex);
+    buffer->name = name;
+}
+
+/*---------------------------------------------------------------------------*/
+
+void traceRecord(const char *name, steady_clock::time_point start, steady_clock::time_point end) {
+    TraceBuffer *buffer = getBuffer();
+    TraceEvent& event = buffer->events[buffer->next];
+    event.name = name;
+    event.start = duration_cast<nanoseconds>(start - traceStart).count();
+    event.duration = duration_cast<nanoseconds>(end - start).count();
+    buffer->next++;
+    if (buffer->next == buffer->events.size()) {
+        buffer->next = 0;
+        buffer->wrapped = true;
+    }
+}
+
+/*---------------------------------------------------------------------------*/
+
+static void addEvents(json& events, const TraceBuffer& buffer) {
+    json meta;
+    meta["name"] = "thread_name";
+    meta["ph"] = "M";
+    meta["pid"] = 1;
+    meta["tid"] = buffer.tid;
+    meta["args"]["name"] = buffer.name != "" ? buffer.name : "thread " + std::to_string(buffer.tid);
+    events.push_back(meta);
+
+    // Oldest first
+    size_t count = buffer.wrapped ? buffer.events.size() : buffer.next;
+    size_t first = buffer.wrapped ? buffer.next : 0;
+    for (size_t i = 0; i < count; i++) {
+        const TraceEvent& e = buffer.events[(first + i) % buffer.events.size()];
+        json event;
+        event["name"] = e.name;
+        event["ph"] = "X";
+        event["pid"] = 1;
+        event["tid"] = buffer.tid;
+        event["ts"] = e.start / 1000.0;
+        event["dur"] = e.duration / 1000.0;
+        events.push_back(event);
+    }
+}
+
+JobStatus traceWrite(const std::string& filename) {
+    json trace;
+    json& events = trace["traceEvents"];
+    events = json::array();
+    {
+        std::lock_guard<std::mutex> lock(buffersMutex);
+        for (size_t i = 0; i < buffers.size(); i++) {
+            addEvents(events, *buffers[i]);
+        }
+    }
+    trace["displayTimeUnit"] = "ms";
+
+    std::ofstream out(filename.c_str());
+    out << trace.dump() << std::endl;
+    out.close();
+    if (!out) {
+        error_return("Cannot write trace to: %s", filename.c_str());
+    }
+    return EXIT_SUCCESS;
+}
+
+/*---------------------------------------------------------------------------*/
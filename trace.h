@@ -0,0 +1,63 @@
+#ifndef __GETIMAGE_TRACE__
+#define __GETIMAGE_TRACE__
+
+#include <chrono>
+#include <string>
+
+#include "common.h"
+
+/*---------------------------------------------------------------------------*/
+// Spans around the stages of the jobs, written with --trace as a Chrome
+// trace (chrome://tracing, ui.perfetto.dev). Each thread records into its
+// own ring buffer, which keeps its last TRACE_RING_SIZE spans. While
+// tracing is off, a span costs the test of a flag.
+/*---------------------------------------------------------------------------*/
+
+#define TRACE_RING_SIZE (1 << 16)
+
+// Only set before any thread starts
+extern bool traceOn;
+
+void traceEnable();
+
+// Name of the calling thread in the trace
+void traceThreadName(const std::string& name);
+
+void traceRecord(const char *name, std::chrono::steady_clock::time_point start, std::chrono::steady_clock::time_point end);
+
+// Write the spans of all threads, which must be done recording
+JobStatus traceWrite(const std::string& filename);
+
+// Names must be string literals: only the pointer is kept
+
+class TraceSpan {
+public:
+    explicit TraceSpan(const char *name) : name(traceOn ? name : NULL) {
+        if (this->name != NULL) {
+            start = std::chrono::steady_clock::now();
+        }
+    }
+
+    ~TraceSpan() {
+        end();
+    }
+
+    // End the span before the end of its scope
+    void end() {
+        if (name != NULL) {
+            traceRecord(name, start, std::chrono::steady_clock::now());
+            name = NULL;
+        }
+    }
+
+private:
+    TraceSpan(const TraceSpan&);
+    TraceSpan& operator=(const TraceSpan&);
+
+    const char *name;   // NULL once ended, or when not tracing
+    std::chrono::steady_clock::time_point start;
+};
+
+/*---------------------------------------------------------------------------*/
+
+#endif
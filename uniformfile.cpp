@@ -0,0 +1,302 @@
+#include <list>
+#include <mutex>
+#include <string.h>
+#include <sys/stat.h>
+
+#include "uniformfile.h"
+#include "filemap.h"
+#include "json.hpp"
+
+using json = nlohmann::json;
+
+/*---------------------------------------------------------------------------*/
+
+void uniformSetAdd(UniformSet& uniforms, const std::string& name, const std::string& func, const std::vector<double>& args) {
+    UniformEntry& entry = uniforms[name];
+    entry.hasFunc = true;
+    entry.funcIsString = true;
+    entry.func = func;
+    entry.hasArgs = true;
+    entry.argsIsArray = true;
+    entry.args = args;
+    entry.argsError = "";
+}
+
+/*---------------------------------------------------------------------------*/
+// Parser
+/*---------------------------------------------------------------------------*/
+
+// Only these values are looked at, the others are skipped:
+//   depth 0: the file, an object of entries
+//   depth 1: an entry, an object of fields
+//   depth 2: the "func" and "args" fields
+//   depth 3: the args
+
+typedef enum {
+    FIELD_OTHER,
+    FIELD_FUNC,
+    FIELD_ARGS
+} UniformField;
+
+class UniformParser : public nlohmann::json_sax<json> {
+public:
+    explicit UniformParser(UniformSet& uniforms)
+        : notObject(false), uniforms(uniforms), entry(NULL), field(FIELD_OTHER), depth(0), skip(0) {}
+
+    bool null() override { return scalar("null", false, 0.0, NULL); }
+    bool boolean(bool) override { return scalar("boolean", false, 0.0, NULL); }
+    bool number_integer(number_integer_t val) override { return scalar("number", true, (double) val, NULL); }
+    bool number_unsigned(number_unsigned_t val) override { return scalar("number", true, (double) val, NULL); }
+    bool number_float(number_float_t val, const string_t&) override { return scalar("number", true, val, NULL); }
+    bool string(string_t& val) override { return scalar("string", false, 0.0, &val); }
+
+    bool start_object(std::size_t) override { return open(true); }
+    bool end_object() override { return close(); }
+    bool start_array(std::size_t) override { return open(false); }
+    bool end_array() override { return close(); }
+
+    bool key(string_t& val) override {
+        if (skip > 0) {
+            return true;
+        }
+        if (depth == 1) {
+            // Like json::parse(), the last of duplicate entries wins
+            entry = &uniforms[val];
+            *entry = UniformEntry();
+        } else if (depth == 2) {
+            field = val == "func" ? FIELD_FUNC : val == "args" ? FIELD_ARGS : FIELD_OTHER;
+            clearField();
+        }
+        return true;
+    }
+
+    bool parse_error(std::size_t, const std::string&, const nlohmann::detail::exception& ex) override {
+        error = ex.what();
+        return false;
+    }
+
+    std::string error;
+    bool notObject;
+
+private:
+    UniformSet& uniforms;
+    UniformEntry *entry;
+    UniformField field;
+    int depth;
+    int skip;       // Depth of the first skipped value, 0 if none
+
+    // The last of duplicate fields wins too
+    void clearField() {
+        if (field == FIELD_FUNC) {
+            entry->hasFunc = false;
+            entry->funcIsString = false;
+            entry->func.clear();
+        } else if (field == FIELD_ARGS) {
+            entry->hasArgs = false;
+            entry->argsIsArray = false;
+            entry->args.clear();
+            entry->argsError = "";
+            entry->badArg = 0;
+        }
+    }
+
+    void addArg(const char *type, bool isNumber, double number) {
+        if (!isNumber && entry->argsError == "") {
+            // Same message as the json conversions
+            entry->argsError = std::string("type must be number, but is ") + type;
+            entry->badArg = entry->args.size();
+        }
+        entry->args.push_back(number);
+    }
+
+    bool scalar(const char *type, bool isNumber, double number, std::string *str) {
+        if (skip > 0) {
+            return true;
+        }
+        switch (depth) {
+        case 0:
+            notObject = true;
+            break;
+        case 1:
+            // Not an object: an entry without fields
+            break;
+        case 2:
+            if (field == FIELD_FUNC) {
+                entry->hasFunc = true;
+                if (str != NULL) {
+                    entry->funcIsString = true;
+                    entry->func.swap(*str);
+                }
+            } else if (field == FIELD_ARGS) {
+                entry->hasArgs = true;
+            }
+            break;
+        default:
+            addArg(type, isNumber, number);
+            break;
+        }
+        return true;
+    }
+
+    bool open(bool isObject) {
+        if (skip == 0) {
+            bool enter = false;
+            switch (depth) {
+            case 0:
+                enter = isObject;
+                notObject = !isObject;
+                break;
+            case 1:
+                enter = isObject;
+                break;
+            case 2:
+                if (field == FIELD_FUNC) {
+                    entry->hasFunc = true;
+                } else if (field == FIELD_ARGS) {
+                    entry->hasArgs = true;
+                    entry->argsIsArray = !isObject;
+                    enter = !isObject;
+                }
+                break;
+            default:
+                addArg(isObject ? "object" : "array", false, 0.0);
+                break;
+            }
+            if (!enter) {
+                skip = depth + 1;
+            }
+        }
+        depth++;
+        return true;
+    }
+
+    bool close() {
+        depth--;
+        if (skip > depth) {
+            skip = 0;
+        }
+        return true;
+    }
+};
+
+/*---------------------------------------------------------------------------*/
+
+// Where is the file, or line of a file, for the error messages
+
+static JobStatus parseUniforms(const char *begin, const char *end, const std::string& where, UniformSet& uniforms) {
+    UniformParser parser(uniforms);
+    if (!json::sax_parse(begin, end, &parser)) {
+        error_return("malformed JSON %s: %s", where.c_str(), parser.error.c_str());
+    }
+    if (parser.notObject) {
+        error_return("malformed JSON %s: not an object", where.c_str());
+    }
+    return EXIT_SUCCESS;
+}
+
+static JobStatus parseUniformFile(const std::string& filename, UniformSet& uniforms) {
+    FileContents contents;
+    CHECK_STATUS(contents.load(filename));
+    const char *begin = contents.data();
+    return parseUniforms(begin, begin + contents.size(), "file " + filename, uniforms);
+}
+
+/*---------------------------------------------------------------------------*/
+// Cache
+/*---------------------------------------------------------------------------*/
+
+#define UNIFORM_CACHE_SIZE (32)
+
+typedef struct {
+    std::string filename;
+    off_t size;
+    time_t mtime;
+    std::shared_ptr<const UniformSet> uniforms;
+} UniformCacheEntry;
+
+// Most recently used first
+static std::list<UniformCacheEntry> uniformCache;
+static std::mutex uniformCacheMutex;
+
+/*---------------------------------------------------------------------------*/
+
+JobStatus uniformFileLoad(const std::string& filename, std::shared_ptr<const UniformSet>& uniforms) {
+    struct stat st;
+    if (stat(filename.c_str(), &st) != 0) {
+        error_return("File not found: %s", filename.c_str());
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(uniformCacheMutex);
+        for (std::list<UniformCacheEntry>::iterator it = uniformCache.begin(); it != uniformCache.end(); ++it) {
+            if (it->filename == filename) {
+                if (it->size == st.st_size && it->mtime == st.st_mtime) {
+                    uniforms = it->uniforms;
+                    uniformCache.splice(uniformCache.begin(), uniformCache, it);
+                    return EXIT_SUCCESS;
+                }
+                uniformCache.erase(it);
+                break;
+            }
+        }
+    }
+
+    // Parse without the lock: other files can be loaded meanwhile
+    std::shared_ptr<UniformSet> parsed = std::make_shared<UniformSet>();
+    CHECK_STATUS(parseUniformFile(filename, *parsed));
+    uniforms = parsed;
+
+    std::lock_guard<std::mutex> lock(uniformCacheMutex);
+    for (std::list<UniformCacheEntry>::iterator it = uniformCache.begin(); it != uniformCache.end(); ++it) {
+        if (it->filename == filename) {
+            // Parsed by another thread meanwhile
+            uniformCache.erase(it);
+            break;
+        }
+    }
+    UniformCacheEntry entry;
+    entry.filename = filename;
+    entry.size = st.st_size;
+    entry.mtime = st.st_mtime;
+    entry.uniforms = uniforms;
+    uniformCache.push_front(entry);
+    if (uniformCache.size() > UNIFORM_CACHE_SIZE) {
+        uniformCache.pop_back();
+    }
+    return EXIT_SUCCESS;
+}
+
+/*---------------------------------------------------------------------------*/
+// Variants
+/*---------------------------------------------------------------------------*/
+
+JobStatus uniformVariantsLoad(const std::string& filename, std::vector<UniformSet>& variants) {
+    FileContents contents;
+    CHECK_STATUS(contents.load(filename));
+
+    variants.clear();
+    const char *p = contents.data();
+    const char *end = p + contents.size();
+    for (int line = 1; p < end; line++) {
+        const char *eol = (const char *) memchr(p, '\n', end - p);
+        if (eol == NULL) {
+            eol = end;
+        }
+        const char *c = p;
+        while (c < eol && (*c == ' ' || *c == '\t' || *c == '\r')) {
+            c++;
+        }
+        if (c < eol) {
+            variants.push_back(UniformSet());
+            std::string where = "line " + std::to_string(line) + " of " + filename;
+            CHECK_STATUS(parseUniforms(p, eol, where, variants.back()));
+        }
+        p = eol + 1;
+    }
+    if (variants.empty()) {
+        error_return("No uniform sets in %s", filename.c_str());
+    }
+    return EXIT_SUCCESS;
+}
+
+/*---------------------------------------------------------------------------*/
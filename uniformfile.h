@@ -0,0 +1,44 @@
+#ifndef __GETIMAGE_UNIFORMFILE__
+#define __GETIMAGE_UNIFORMFILE__
+
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "common.h"
+
+/*---------------------------------------------------------------------------*/
+// Uniform JSON files, parsed straight into their entries rather than into
+// a JSON document. Errors within an entry are only recorded: they only
+// matter if the program has the uniform.
+/*---------------------------------------------------------------------------*/
+
+typedef struct {
+    bool hasFunc;
+    bool funcIsString;
+    std::string func;
+    bool hasArgs;
+    bool argsIsArray;
+    std::vector<double> args;   // Exact for any float, int or uint value
+    std::string argsError;      // Why args are not all numbers, if they are not
+    size_t badArg;              // Index of the first arg that is not a number
+} UniformEntry;
+
+typedef std::unordered_map<std::string, UniformEntry> UniformSet;
+
+// Add a well-formed entry
+void uniformSetAdd(UniformSet& uniforms, const std::string& name, const std::string& func, const std::vector<double>& args);
+
+// Parse a uniform JSON file. The result is cached, and shared until the
+// size or modification time of the file changes. Safe to call from
+// several threads.
+JobStatus uniformFileLoad(const std::string& filename, std::shared_ptr<const UniformSet>& uniforms);
+
+// Parse a JSONL file of uniform sets, one object per line, each like a
+// uniform JSON file. Blank lines are skipped. Not cached.
+JobStatus uniformVariantsLoad(const std::string& filename, std::vector<UniformSet>& variants);
+
+/*---------------------------------------------------------------------------*/
+
+#endif
@@ -0,0 +1,91 @@
+#ifndef __GETIMAGE_WORKQUEUE__
+#define __GETIMAGE_WORKQUEUE__
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <utility>
+
+#include "trace.h"
+
+/*---------------------------------------------------------------------------*/
+
+// Bounded blocking FIFO shared between threads. push() blocks while the
+// queue is full, which gives backpressure to the producer; pop() blocks
+// while it is empty, and returns false once the queue is closed and
+// drained.
+
+// Waits show up in --trace, to see which side holds the other back
+
+template<typename T>
+class WorkQueue {
+public:
+    explicit WorkQueue(size_t capacity) : capacity(capacity), closed(false) {}
+
+    void push(const T& item) {
+        std::unique_lock<std::mutex> lock(mutex);
+        if (items.size() >= capacity) {
+            TraceSpan span("WorkQueue::push wait");
+            notFull.wait(lock, [this] { return items.size() < capacity; });
+        }
+        items.push_back(item);
+        notEmpty.notify_one();
+    }
+
+    // Same as push(), without copying large items
+    void push(T&& item) {
+        std::unique_lock<std::mutex> lock(mutex);
+        if (items.size() >= capacity) {
+            TraceSpan span("WorkQueue::push wait");
+            notFull.wait(lock, [this] { return items.size() < capacity; });
+        }
+        items.push_back(std::move(item));
+        notEmpty.notify_one();
+    }
+
+    bool pop(T& item) {
+        std::unique_lock<std::mutex> lock(mutex);
+        if (!closed && items.empty()) {
+            TraceSpan span("WorkQueue::pop wait");
+            notEmpty.wait(lock, [this] { return closed || !items.empty(); });
+        }
+        if (items.empty()) {
+            return false;
+        }
+        item = std::move(items.front());
+        items.pop_front();
+        notFull.notify_one();
+        return true;
+    }
+
+    // Same as pop(), but returns false rather than waiting if empty
+    bool tryPop(T& item) {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (items.empty()) {
+            return false;
+        }
+        item = std::move(items.front());
+        items.pop_front();
+        notFull.notify_one();
+        return true;
+    }
+
+    // No more push() after this: wake up the consumers so they can finish
+    void close() {
+        std::lock_guard<std::mutex> lock(mutex);
+        closed = true;
+        notEmpty.notify_all();
+    }
+
+private:
+    size_t capacity;
+    bool closed;
+    std::deque<T> items;
+    std::mutex mutex;
+    std::condition_variable notEmpty;
+    std::condition_variable notFull;
+};
+
+/*---------------------------------------------------------------------------*/
+
+#endif